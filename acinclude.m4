@@ -264,37 +264,40 @@ dnl
 AC_DEFUN([CGPS_CHECK_THREADING],
 [
   AC_CHECK_LIB([pthread], [pthread_create])
-  AC_CHECK_FUNCS([pthread_yield sched_yield])
+  AC_CHECK_FUNCS([sched_yield])
   AC_CHECK_HEADERS([sched.h])
   if test "x${ac_cv_lib_pthread_pthread_create}" == "xyes"; then
     CFLAGS="$CFLAGS -pthread"
     CPPFLAGS="$CPPFLAGS -D_REENTRANT -D_THREAD_SAFE"
-    AC_CHECK_LIB([pthread], [pthread_yield], 
-    [
-      AC_DEFINE([HAVE_PTHREAD_YIELD], [1], [Define to 1 if libpthread has function pthread_yield])
-    ])
-    AC_MSG_CHECKING([if pthread_yield needs _GNU_SOURCE defined])
-    AC_COMPILE_IFELSE(
+  fi
+])
+
+dnl
+dnl Check if the compiler can build the numeric kernels for multiple instruction
+dnl sets (target attribute) and select one at runtime (__builtin_cpu_supports).
+dnl The library itself is compiled for the generic target, so one binary runs
+dnl on all nodes in a heterogeneous cluster.
+dnl
+AC_DEFUN([CGPS_CHECK_CPU_DISPATCH],
+[
+  AC_ARG_ENABLE(cpu-dispatch,
+  AC_HELP_STRING([--disable-cpu-dispatch], [Only build the scalar numeric kernels]),
+  [cgps_use_cpu_dispatch=$enableval],
+  [cgps_use_cpu_dispatch="yes"])
+  
+  if test "$cgps_use_cpu_dispatch" = "yes"; then
+    AC_MSG_CHECKING([whether $CC supports runtime CPU dispatch])
+    AC_LINK_IFELSE([AC_LANG_PROGRAM([
+      typedef float v16sf __attribute__((vector_size(64), aligned(4), may_alias));
+      __attribute__((target("avx512f"))) static void scale(float *p) { *(v16sf *)p *= 2.0f; }
+      ], [
+      float p[[16]] = { 0 };
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx512f")) { scale(p); }
+      ])], 
     [
-      #include <pthread.h>
-      int main(void) { pthread_yield(); return 0; }
-      ], [AC_MSG_RESULT(no)], [
       AC_MSG_RESULT(yes)
-      CPPFLAGS="$CPPFLAGS -D_GNU_SOURCE"
-    ])
-    AC_MSG_CHECKING([if pthread_yield needs to be declared])
-    AC_COMPILE_IFELSE([
-      #ifdef _GNU_SOURCE
-      # undef _GNU_SOURCE
-      #endif
-      #define _GNU_SOURCE 1
-      #include <features.h>
-      #include <pthread.h>
-      int main(void) { pthread_yield(); return 0; }
-      ], [AC_MSG_RESULT(no)], 
-      [
-        AC_MSG_RESULT(yes)
-        AC_DEFINE([NEED_PTHREAD_YIELD_DECL], [1], [Define to 1 if pthread_yield() needs to be declared])
-      ])
+      AC_DEFINE([HAVE_CPU_DISPATCH], [1], [Define to 1 if the compiler supports runtime CPU dispatch])
+    ], [AC_MSG_RESULT(no)])
   fi
 ])
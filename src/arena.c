@@ -0,0 +1,205 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Arena for the scratch memory of a prediction. Memory is handed out from 
+ * a chain of blocks by bumping an offset and is released all at once, by
+ * moving the offset back. The blocks are kept for the next prediction, so
+ * once the arena has grown to the size needed no further calls to malloc(3)
+ * are made.
+ * 
+ * The allocations made while preparing a prediction are kept by calling
+ * cgps_arena_keep(), the following allocations are released by each call to
+ * cgps_arena_reset(). All allocations are aligned to CGPS_ARENA_ALIGN bytes.
+ */
+
+#define CGPS_ARENA_BLOCK 4096    /* minimum block size */
+
+struct cgps_arena_block
+{
+	struct cgps_arena_block *next;   /* next block in chain */
+	size_t size;                     /* usable size */
+	size_t used;                     /* bytes in use */
+};
+
+/*
+ * Round size up to the arena alignment.
+ */
+#define cgps_arena_round(size) \
+	(((size) + CGPS_ARENA_ALIGN - 1) & ~((size_t)CGPS_ARENA_ALIGN - 1))
+
+#define CGPS_ARENA_HEADER cgps_arena_round(sizeof(struct cgps_arena_block))
+
+#define cgps_arena_data(block) ((char *)(block) + CGPS_ARENA_HEADER)
+
+/*
+ * Make a block with at least size free bytes current. The next block in 
+ * chain is reused if large enough, otherwise the blocks following current
+ * are replaced by a new block. Returns -1 if out of memory.
+ */
+static int cgps_arena_next(struct cgps_arena *arena, size_t size)
+{
+	struct cgps_arena_block *block, *next;
+	void *data;
+	
+	if(arena->curr && arena->curr->next && arena->curr->next->size >= size) {
+		arena->curr = arena->curr->next;
+		arena->curr->used = 0;
+		return 0;
+	}
+	
+	if(arena->curr) {
+		if(size < 2 * arena->curr->size) {
+			size = 2 * arena->curr->size;
+		}
+		for(block = arena->curr->next; block; block = next) {
+			next = block->next;
+			free(block);
+		}
+		arena->curr->next = NULL;
+	}
+	if(size < CGPS_ARENA_BLOCK) {
+		size = CGPS_ARENA_BLOCK;
+	}
+	
+	if(posix_memalign(&data, CGPS_ARENA_ALIGN, CGPS_ARENA_HEADER + size) != 0) {
+		return -1;
+	}
+	block = data;
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	
+	if(arena->curr) {
+		arena->curr->next = block;
+	} else {
+		arena->block = block;
+	}
+	arena->curr = block;
+	return 0;
+}
+
+/*
+ * Allocate size bytes from arena. Returns NULL if out of memory.
+ */
+void * cgps_arena_alloc(struct cgps_arena *arena, size_t size)
+{
+	struct cgps_arena_block *block;
+	void *ptr;
+	
+	size = cgps_arena_round(size ? size : 1);
+	
+	if(!arena->curr && arena->block) {
+		arena->curr = arena->block;
+		arena->curr->used = 0;
+	}
+	if(!arena->curr || arena->curr->size - arena->curr->used < size) {
+		if(cgps_arena_next(arena, size) < 0) {
+			return NULL;
+		}
+	}
+	block = arena->curr;
+	ptr = cgps_arena_data(block) + block->used;
+	block->used += size;
+	return ptr;
+}
+
+/*
+ * Make sure that the following allocations of total size bytes are made 
+ * from the same block. Used for pre-sizing the arena. Returns -1 if out of
+ * memory.
+ */
+int cgps_arena_reserve(struct cgps_arena *arena, size_t size)
+{
+	size = cgps_arena_round(size);
+	
+	if(!arena->curr && arena->block) {
+		arena->curr = arena->block;
+		arena->curr->used = 0;
+	}
+	if(arena->curr && arena->curr->size - arena->curr->used >= size) {
+		return 0;
+	}
+	return cgps_arena_next(arena, size);
+}
+
+/*
+ * Keep the current allocations when the arena is reset.
+ */
+void cgps_arena_keep(struct cgps_arena *arena)
+{
+	arena->keep = arena->curr;
+	arena->kept = arena->curr ? arena->curr->used : 0;
+}
+
+/*
+ * Release all allocations made after cgps_arena_keep().
+ */
+void cgps_arena_reset(struct cgps_arena *arena)
+{
+	arena->curr = arena->keep;
+	if(arena->curr) {
+		arena->curr->used = arena->kept;
+	}
+}
+
+/*
+ * Release all allocations, including the kept.
+ */
+void cgps_arena_clear(struct cgps_arena *arena)
+{
+	arena->curr = NULL;
+	arena->keep = NULL;
+	arena->kept = 0;
+}
+
+/*
+ * Release the memory of arena.
+ */
+void cgps_arena_free(struct cgps_arena *arena)
+{
+	struct cgps_arena_block *block, *next;
+	
+	for(block = arena->block; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	arena->block = NULL;
+	cgps_arena_clear(arena);
+}
@@ -61,6 +61,24 @@ int cgps_set_option(struct cgps_project *proj, int option, const void *value)
 	case CGPS_OPTION_PREFIX:
 		proj->opts->prog = (const char *)value;
 		break;
+	case CGPS_OPTION_PRECISION:
+		proj->opts->precision = *(int *)value;
+		break;
+	case CGPS_OPTION_ENGINE:
+		proj->opts->engine = *(int *)value;
+		break;
+	case CGPS_OPTION_KERNEL:
+		logerr("option %d is read-only", option);
+		return -1;
+	case CGPS_OPTION_LAZY:
+		proj->opts->lazy = *(int *)value;
+		break;
+	case CGPS_OPTION_RESULT_THREADS:
+		proj->opts->rthreads = *(int *)value;
+		break;
+	case CGPS_OPTION_WORKER_THREADS:
+		proj->opts->wthreads = *(int *)value;
+		break;
 	case CGPS_OPTION_LICENSE:
 		proj->opts->license = (char *)value;
 		break;
@@ -100,6 +118,24 @@ int cgps_get_option(struct cgps_project *proj, int option, void *value)
 	case CGPS_OPTION_PREFIX:
 		value = (char *)proj->opts->prog;
 		break;
+	case CGPS_OPTION_PRECISION:
+		*(int *)value = proj->opts->precision;
+		break;
+	case CGPS_OPTION_ENGINE:
+		*(int *)value = proj->opts->engine;
+		break;
+	case CGPS_OPTION_KERNEL:
+		*(int *)value = cgps_kernel->variant;
+		break;
+	case CGPS_OPTION_LAZY:
+		*(int *)value = proj->opts->lazy;
+		break;
+	case CGPS_OPTION_RESULT_THREADS:
+		*(int *)value = proj->opts->rthreads;
+		break;
+	case CGPS_OPTION_WORKER_THREADS:
+		*(int *)value = proj->opts->wthreads;
+		break;
 	default:
 		logerr("unknown option %d for cgps_set_option", option);
 		return -1;
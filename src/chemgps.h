@@ -43,12 +43,34 @@
 #define CGPS_OPTION_VERBOSE  5   /* read-write (int) */
 #define CGPS_OPTION_RESULT   6   /* read-write (int) */
 #define CGPS_OPTION_PREFIX   7   /* read-write (const char *) */
+#define CGPS_OPTION_PRECISION 8  /* read-write (int) */
+#define CGPS_OPTION_ENGINE   9   /* read-write (int) */
+#define CGPS_OPTION_KERNEL  10   /* read-only (int) */
+#define CGPS_OPTION_LAZY    11   /* read-write (int) */
 #define CGPS_OPTION_LICENSE 12   /* write-only (const char *) */
+#define CGPS_OPTION_RESULT_THREADS 13  /* read-write (int) */
+#define CGPS_OPTION_WORKER_THREADS 14  /* read-write (int) */
 
 #define CGPS_OUTPUT_FORMAT_PLAIN 1
 #define CGPS_OUTPUT_FORMAT_XML   2
+#define CGPS_OUTPUT_FORMAT_BINARY 3  /* framed little endian float32 */
+#define CGPS_OUTPUT_FORMAT_JSON   4
 #define CGPS_OUTPUT_FORMAT_DEFAULT CGPS_OUTPUT_FORMAT_PLAIN
 
+/*
+ * Prediction engines for the engine member of cgps_options:
+ */
+#define CGPS_ENGINE_SIMCAQP 0    /* Always use SQP_Predict() */
+#define CGPS_ENGINE_NATIVE  1    /* Compute supported results in libchemgps */
+
+/*
+ * Numeric kernel variants used by the native engine (CGPS_OPTION_KERNEL):
+ */
+#define CGPS_KERNEL_SCALAR 0     /* Portable C */
+#define CGPS_KERNEL_SSE42  1     /* SSE 4.2 (128-bit vectors) */
+#define CGPS_KERNEL_AVX2   2     /* AVX2 (256-bit vectors) */
+#define CGPS_KERNEL_AVX512 3     /* AVX-512F (512-bit vectors) */
+
 #define DEFAULT_NUMBER_OBSERVATIONS 1
 
 /*
@@ -112,12 +134,82 @@ enum PREDICTED_RESULTS {
 	PREDICTED_RESULTS_LAST	          /* NaN entry */
 };
 
+/*
+ * Model descriptor (immutable once the model is loaded).
+ */
+#define CGPS_RESULT_PLANS 4  /* result plans cached per model */
+
+struct cgps_model
+{
+	int index;                           /* model index */
+	int number;                          /* model number */
+	int fitted;                          /* model is fitted */
+	int numcomp;                         /* number of components */
+	SQX_ModelType type;                  /* model type */
+	SQX_StringVector varnames;           /* variable names needed as input to Predict() */
+	SQX_StringVector lagparents;         /* lag parent names for Predict() */
+	SQX_StringVector qualnames;          /* qualitative names for Predict() */
+	SQX_StringVector qlagnames;          /* qualitative lagged data names for Predict() */
+	struct cgps_native *native;          /* native engine parameters (NULL if not available) */
+	int state;                           /* load state (see simcaqp.h) */
+	struct cgps_result_plan *plan[CGPS_RESULT_PLANS];  /* result getters (see result.c) */
+};
+
 struct cgps_project
 {
 	struct cgps_options *opts;  /* common options */
 	SQX_ProjectHandle handle;   /* project handle */
 	int models;                 /* number of models */
 	char *name;                 /* project name */
+	int isreduced;              /* project is a reduced project (*.rusp) */
+	int isdatainc;              /* primary data set is included */
+	int isresuinc;              /* model residuals is included */
+	struct cgps_model *model;   /* model descriptors (index 0 .. models - 1) */
+	int pid;                    /* process using the project handle (0 unless prepared for fork) */
+	void *mapped;               /* mapped model file (no project handle) */
+	size_t mapsize;             /* size of mapped model file */
+	int refs;                   /* references on project in cgps_project_live */
+};
+
+/*
+ * Project that can be reloaded while predictions are running. The project 
+ * is acquired for making predictions and released when done.
+ */
+struct cgps_project_live
+{
+	struct cgps_project *proj;  /* published project */
+	struct cgps_options *opts;  /* options for loading the project */
+	int lock;                   /* guards proj during acquire and publish */
+};
+
+/*
+ * Descriptor table loaded from delimited text (see cgps_table_load()).
+ */
+struct cgps_table
+{
+	int delim;                  /* column delimiter */
+	int cols;                   /* number of columns */
+	const char **colnames;      /* column names from header */
+	int rows;                   /* number of rows */
+	float *values;              /* rows x cols values (row-major, NaN if not a number) */
+	char *text;                 /* table text (for qualitative data) */
+	size_t size;                /* size of text */
+	size_t *rowpos;             /* offset of each row in text */
+	char *header;               /* storage for column names */
+	size_t next;                /* offset of next row to parse */
+	int line;                   /* line number of last parsed line */
+	int chunk;                  /* rows per chunk (0 if not mapped) */
+	size_t drop;                /* end of released pages (mapped) */
+};
+
+#define CGPS_TABLE_HUGEPAGES 1  /* flag for cgps_table_open() */
+
+struct cgps_project_pool
+{
+	struct cgps_project *proj;  /* project handles */
+	int *busy;                  /* handle is checked out */
+	int size;                   /* number of handles */
+	int next;                   /* next handle to try */
 };
 
 typedef void (*logfunc)(void *pref, int errcode, int level, const char *file, unsigned int line, const char *fmt, ...);
@@ -136,10 +228,26 @@ struct cgps_options
 	char *license;              /* simca-qp license path */
 	int format;                 /* output format */
 	int result;                 /* bitmask of results */	
+	int precision;              /* significant digits in JSON (0 = shortest) */
+	int engine;                 /* prediction engine */
+	int lazy;                   /* load models on first use */
+	int rthreads;               /* threads for extracting results */
+	int wthreads;               /* threads for predicting models (and pool size) */
 	logfunc logger;             /* log function callback */
 	datfunc indata;             /* external data loader */
 };
 
+/*
+ * Scratch memory of a prediction (see arena.c).
+ */
+struct cgps_arena
+{
+	struct cgps_arena_block *block;  /* first block */
+	struct cgps_arena_block *curr;   /* block allocated from (NULL if empty) */
+	struct cgps_arena_block *keep;   /* block of the kept allocations */
+	size_t kept;                     /* bytes kept in keep */
+};
+
 struct cgps_predict
 {
 	SQX_StringMatrix *mqrawdata;         /* pQualData */
@@ -149,11 +257,25 @@ struct cgps_predict
 	SQP_ObservationRawData *porawdata;   /* pObservationRawData */
 	SQP_QualitativeRawData *pqrawdata;   /* pQualitativeRawData */
 	SQX_PredictionHandle handle;         /* pPredict */
-	SQX_StringVector varnames;           /* variable names needed as input to Predict() */
-	SQX_StringVector lagparents;         /* lag parent names for Predict() */
-	SQX_StringVector qualnames;          /* qualitative names for Predict() */
-	SQX_StringVector qlagnames;          /* qualitative lagged data names for Predict() */
 	void *data;                          /* callback data for indata() */
+	struct cgps_model *model;            /* prepared model */
+	struct cgps_project *proj;           /* project of prepared model */
+	int ref;                             /* holds reference on proj */
+	int loaded;                          /* data containers are filled */
+	const float *batch;                  /* observation matrix from cgps_predict_set_input() */
+	int rows;                            /* number of observations in batch */
+	int cols;                            /* number of columns in batch */
+	int stride;                          /* number of floats between rows in batch */
+	const char **colnames;               /* names of batch columns (NULL if in model order) */
+	int *colmap;                         /* batch column of each model variable */
+	struct cgps_model *mapmodel;         /* model colmap is resolved for */
+	int obs;                             /* number of predicted observations */
+	int native;                          /* predicted by the native engine */
+	float *xdata;                        /* observations for native engine (column major) */
+	float *tdata;                        /* scores from native engine (column major) */
+	float *edata;                        /* residuals from native engine (column major) */
+	float *ydata;                        /* predicted Y from native engine (column major) */
+	struct cgps_arena arena;             /* data containers and native engine data */
 };
 
 struct cgps_result
@@ -163,6 +285,11 @@ struct cgps_result
 	SQX_IntVector index1;       /* oObsIndex1 */
 	SQX_IntVector index2;       /* oObsIndex1 */
 	FILE *out;                  /* result destination (socket or file) */
+	const struct cgps_result_sink *sink;  /* result consumer */
+	void *data;                 /* callback data for sink */
+	struct cgps_matrix *values; /* result matrices reused between requests */
+	int nres;                   /* results written (JSON) */
+	int nval;                   /* value arrays written in result (JSON) */
 };
 
 struct cgps_result_entry
@@ -177,6 +304,21 @@ const struct cgps_result_entry * cgps_result_entry_value(const char *name);
 
 extern const struct cgps_result_entry cgps_result_entry_list[];
 
+/*
+ * Result sink for cgps_result_to_sink(). The callbacks gets called with the
+ * data argument passed to cgps_result_to_sink() and any of them might be 
+ * NULL. The values passed to matrix() are stored column by column and are
+ * only valid during the call. Return -1 from a callback to signal an error.
+ */
+struct cgps_result_sink
+{
+	int (*begin_document)(struct cgps_project *proj, void *data, int model);
+	int (*begin_result)(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry);
+	int (*matrix)(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry, const float *values, int rows, int cols);
+	int (*end_result)(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry);
+	int (*end_document)(struct cgps_project *proj, void *data, int model);
+};
+
 /*
  * Macros for manipulating bitmasks:
  */
@@ -195,11 +337,88 @@ extern const struct cgps_result_entry cgps_result_entry_list[];
  */
 int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_options *opts);
 
+/*
+ * Loads a model file exported by cgps_model_export(). The file is mapped 
+ * read-only and all predictions are made by the native engine.
+ */
+int cgps_project_load_mapped(struct cgps_project *proj, const char *path, struct cgps_options *opts);
+
+/*
+ * Export the parameters of model at index (all models if index is 0) to a 
+ * model file for cgps_project_load_mapped().
+ */
+int cgps_model_export(struct cgps_project *proj, int index, const char *path);
+
 /*
  * Close the project and release allocated resources.
  */
 void cgps_project_close(struct cgps_project *proj);
 
+/*
+ * Prepare project for being shared with child processes.
+ */
+int cgps_project_prefork(struct cgps_project *proj);
+
+/*
+ * Restore per process state of the project in a child process.
+ */
+int cgps_project_postfork(struct cgps_project *proj);
+
+/*
+ * Fork a worker process sharing the loaded project. Returns as fork(2).
+ */
+int cgps_project_fork(struct cgps_project *proj);
+
+/*
+ * Load the project in path as a reloadable project.
+ */
+int cgps_project_live_load(struct cgps_project_live *live, const char *path, struct cgps_options *opts);
+
+/*
+ * Get the current project for making predictions (NULL if closed). 
+ */
+struct cgps_project * cgps_project_acquire(struct cgps_project_live *live);
+
+/*
+ * Release a project returned by cgps_project_acquire().
+ */
+void cgps_project_release(struct cgps_project *proj);
+
+/*
+ * Load the project in path and replace the current project with it. 
+ */
+int cgps_project_reload(struct cgps_project_live *live, const char *path);
+
+/*
+ * Close the reloadable project (freed when the last user releases it).
+ */
+void cgps_project_live_close(struct cgps_project_live *live);
+
+/*
+ * Load a pool of size project handles for the project in path.
+ */
+int cgps_project_pool_load(struct cgps_project_pool *pool, const char *path, struct cgps_options *opts, int size);
+
+/*
+ * Checkout a project handle from the pool (NULL if all busy and wait == 0).
+ */
+struct cgps_project * cgps_project_pool_checkout(struct cgps_project_pool *pool, int wait);
+
+/*
+ * Return a project handle to the pool.
+ */
+void cgps_project_pool_checkin(struct cgps_project_pool *pool, struct cgps_project *proj);
+
+/*
+ * Restore per process state of the pool in a child process.
+ */
+int cgps_project_pool_postfork(struct cgps_project_pool *pool);
+
+/*
+ * Close all project handles in the pool.
+ */
+void cgps_project_pool_close(struct cgps_project_pool *pool);
+
 /*
  * Initilize for prediction.
  */
@@ -210,6 +429,90 @@ void cgps_predict_init(struct cgps_project *proj, struct cgps_predict *pred, voi
  */
 int cgps_predict(struct cgps_project *proj, int modind, struct cgps_predict *pred);
 
+/*
+ * Prepare for repeated predictions against model at modind. Returns model 
+ * number or -1 on error.
+ */
+int cgps_predict_prepare(struct cgps_project *proj, int modind, struct cgps_predict *pred);
+
+/*
+ * Make prediction using the prepared model. Returns model number or -1 on error.
+ */
+int cgps_predict_execute(struct cgps_project *proj, struct cgps_predict *pred);
+
+/*
+ * Use the rows x cols matrix in data (row-major with stride floats between 
+ * rows) as quantitative input for the following predictions instead of 
+ * calling the indata callback. If colnames is non-NULL, then it contains 
+ * the names of the columns and the model variables are picked by name, 
+ * otherwise the columns must follow the variable order of the model. The 
+ * data is not copied and must be valid until the input is replaced, cleared
+ * (data is NULL) or cgps_predict_cleanup() is called. Returns -1 on error.
+ */
+int cgps_predict_set_input(struct cgps_project *proj, struct cgps_predict *pred, const float *data, int rows, int cols, int stride, const char **colnames);
+
+/*
+ * Load the descriptor table (CSV or TSV with a header line) in path. The 
+ * delimiter is detected from the header if delim is 0. Returns -1 on error.
+ */
+int cgps_table_load(struct cgps_project *proj, struct cgps_table *table, const char *path, int delim);
+
+/*
+ * Open the descriptor table in path for reading chunk rows at time using
+ * cgps_table_next(). The file is memory mapped and flags is zero or 
+ * CGPS_TABLE_HUGEPAGES. Returns -1 on error.
+ */
+int cgps_table_open(struct cgps_project *proj, struct cgps_table *table, const char *path, int delim, int chunk, int flags);
+
+/*
+ * Parse next chunk of rows in table opened by cgps_table_open(). Returns the
+ * number of rows, 0 at end of table or -1 on error.
+ */
+int cgps_table_next(struct cgps_project *proj, struct cgps_table *table);
+
+/*
+ * Release memory used by table.
+ */
+void cgps_table_free(struct cgps_table *table);
+
+/*
+ * The datfunc callback loading prediction data from the table passed as data
+ * to cgps_predict_init(). The columns are picked by name.
+ */
+int cgps_table_indata(struct cgps_project *proj, void *data, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type);
+
+/*
+ * Make prediction of rows observations stored as one contiguous (row-major) 
+ * matrix in data. Returns model number or -1 on error.
+ */
+int cgps_predict_batch(struct cgps_project *proj, int modind, struct cgps_predict *pred, const float *data, int rows, int cols);
+
+/*
+ * Make prediction against all models in the project and write the result to
+ * out in model order. Returns number of predicted models or -1 
+ * on error.
+ */
+int cgps_predict_all_models(struct cgps_project *proj, void *data, FILE *out);
+
+/*
+ * Make prediction against all models using the project handles in pool.
+ */
+int cgps_predict_all_models_pool(struct cgps_project_pool *pool, void *data, FILE *out);
+
+/*
+ * Predict all rows of the table opened by cgps_table_open() against model at
+ * index, one chunk at time, and write the result of each chunk to out. The
+ * next chunk is loaded and the previous result written while a chunk is
+ * predicted. Returns the number of predicted rows or -1 on error.
+ */
+int cgps_predict_stream(struct cgps_project *proj, int index, struct cgps_table *table, FILE *out);
+
+/*
+ * Same as cgps_predict_stream(), but pass the result of each chunk to the
+ * sink callbacks (called from the calling thread only).
+ */
+int cgps_predict_stream_to_sink(struct cgps_project *proj, int index, struct cgps_table *table, const struct cgps_result_sink *sink, void *data);
+
 /*
  * Cleanup after an prediction.
  */
@@ -225,6 +528,11 @@ int cgps_result_init(struct cgps_project *proj, struct cgps_result *res);
  */
 int cgps_result(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, FILE *out);
 
+/*
+ * Pass result for model to the sink callbacks (see struct cgps_result_sink).
+ */
+int cgps_result_to_sink(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, const struct cgps_result_sink *sink, void *data);
+
 /*
  * Cleanup result.
  */
@@ -29,11 +29,16 @@
 # include "config.h"
 #endif
 
-#define _GNU_SOURCE
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #ifdef HAVE_STDLIB_H
 # include <stdlib.h>
 #endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
 
 #include "chemgps.h"
 #include "simcaqp.h"
@@ -78,35 +83,131 @@ static int cgps_predict_vecstr(struct cgps_project *proj, char **buff, size_t *s
 }
 
 /*
- * Load quantitative (raw) data.
+ * Resolve the batch column of each variable in model, unless already done 
+ * for this model. The columns are used in order (no map) if the input has
+ * no column names.
  */
-int cgps_predict_get_raw_data(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *names)
+int cgps_predict_input_map(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred)
 {
-	int num;            /* number of elements in names */
+	SQX_StringVector *names = &model->varnames;
+	const char *str;
+	int i, j, num;
 	
-	if(!SQP_GetQuantitativeNamesForPredict(proj->handle, model, 0, names)) {
-		logerr("failed get quantitative variable names (%s)", cgps_simcaq_error());
+	if(pred->mapmodel == model) {
+		return 0;
+	}
+	if(pred->colmap) {
+		free(pred->colmap);
+		pred->colmap = NULL;
+	}
+	pred->mapmodel = NULL;
+
+	/*
+	 * The batch only holds the quantitative data. The lagged and qualitative
+	 * containers would be sized by the indata callback for its own number of
+	 * observations, so reject models needing them.
+	 */
+	if(SQX_GetNumStringsInVector(&model->lagparents) > 0 ||
+	   SQX_GetNumStringsInVector(&model->qualnames) > 0 ||
+	   SQX_GetNumStringsInVector(&model->qlagnames) > 0) {
+		logerr("batch input is not supported for model %d (has lagged or qualitative variables)", model->number);
 		return -1;
-	} else {
-		debug("successful got quantitative variable names");
+	}
+
+	num = SQX_GetNumStringsInVector(names);
+	if(!pred->colnames) {
+		if(pred->cols != num) {
+			logerr("batch matrix has %d columns, but model needs %d variables", pred->cols, num);
+			return -1;
+		}
+		pred->mapmodel = model;
+		return 0;
 	}
 	
+	if(!(pred->colmap = malloc((num > 0 ? num : 1) * sizeof(int)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	for(j = 0; j < num; ++j) {
+		if(!SQX_GetStringFromVector(names, j + 1, &str)) {
+			logerr("failed get string from vector (%s)", cgps_simcaq_error());
+			return -1;
+		}
+		for(i = 0; i < pred->cols; ++i) {
+			if(pred->colnames[i] && str && strcmp(pred->colnames[i], str) == 0) {
+				break;
+			}
+		}
+		if(i == pred->cols) {
+			logerr("variable %s of model %d is missing in batch matrix", str ? str : "(null)", model->number);
+			return -1;
+		}
+		pred->colmap[j] = i;
+	}
+	
+	pred->mapmodel = model;
+	debug("resolved %d of %d batch columns for model %d", num, pred->cols, model->number);
+	return 0;
+}
+
+/*
+ * Release the column map of the batch.
+ */
+void cgps_predict_input_free(struct cgps_predict *pred)
+{
+	if(pred->colmap) {
+		free(pred->colmap);
+		pred->colmap = NULL;
+	}
+	pred->mapmodel = NULL;
+}
+
+/*
+ * Copy the batch matrix to the float matrix fmx in the variable order of 
+ * the model.
+ */
+static int cgps_predict_batch_data(struct cgps_project *proj, struct cgps_predict *pred, SQX_FloatMatrix *fmx, int num)
+{
+	int i, j;
+	
+	if(!SQX_InitFloatMatrix(fmx, pred->rows, num)) {
+		logerr("failed initilize float matrix (%s)", cgps_simcaq_error());
+		return -1;
+	}
+	for(i = 0; i < pred->rows; ++i) {
+		for(j = 0; j < num; ++j) {
+			if(!SQX_SetDataInFloatMatrix(fmx, i + 1, j + 1, cgps_predict_input(pred, i, j))) {
+				logerr("failed set float value in matrix (%s)", cgps_simcaq_error());
+				return -1;
+			}
+		}
+	}
+	
+	debug("copied batch of %d observations", pred->rows);
+	return 0;
+}
+
+/*
+ * Load quantitative (raw) data. The data containers are allocated by
+ * cgps_predict_prepare() and filled here for each prediction.
+ */
+int cgps_predict_get_raw_data(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred)
+{
+	SQX_StringVector *names = &model->varnames;
+	int num;            /* number of elements in names */
+	
 	/*
 	 * Set the data to use for the Prediction.
 	 */
 	if((num = SQX_GetNumStringsInVector(names)) > 0) {
 		debug("there are %d \"ordinary\" variables in this model", num);
 
-		if(pred->morawdata) {
-			free(pred->morawdata);
-		}
-		pred->morawdata = malloc(sizeof(SQX_FloatMatrix));
-		if(!pred->morawdata) {
-			logerr("failed alloc memory");
-			return -1;
-		}
-		
-		if(proj->opts->indata(proj, pred->data, pred->morawdata, NULL, names, CGPS_GET_QUANTITATIVE_DATA) < 0) {
+		if(pred->batch) {
+			if(cgps_predict_batch_data(proj, pred, pred->morawdata, num) < 0) {
+				logerr("failed load batch data (quantitative)");
+				return -1;
+			}
+		} else if(proj->opts->indata(proj, pred->data, pred->morawdata, NULL, names, CGPS_GET_QUANTITATIVE_DATA) < 0) {
 			logerr("failed load raw data (quantitative)");
 			return -1;
 		}
@@ -133,14 +234,11 @@ int cgps_predict_get_raw_data(struct cgps_project *proj, int model, struct cgps_
  * Check if the project contains any lagged data. These are the names 
  * of the lagged variables whos data are needed as input for a predition.
  */
-int cgps_predict_get_lag_parents(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *parents)
+int cgps_predict_get_lag_parents(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred)
 {
+	SQX_StringVector *parents = &model->lagparents;
 	int num;       /* number of elements in parents */
 	
-	if(!SQP_GetLagParentNamesForPredict(proj->handle, model, 0, parents)) {
-		logerr("failed get names of lagged variables (%s)", cgps_simcaq_error());
-		return -1;
-	}
 	if((num = SQX_GetNumStringsInVector(parents)) > 0) {
 		debug("there are %d lagged variables in this model", num);
 
@@ -148,15 +246,6 @@ int cgps_predict_get_lag_parents(struct cgps_project *proj, int model, struct cg
 		 * TODO: Check this code against SQPrepareForPredictionExample.c line 83.
 		 */
 		
-		if(pred->molagdata) {
-			free(pred->molagdata);
-		}
-		pred->molagdata = malloc(sizeof(SQX_FloatMatrix));
-		if(!pred->molagdata) {
-			logerr("failed alloc memory");
-			return -1;
-		}
-		
 		if(proj->opts->indata(proj, pred->data, pred->molagdata, NULL, parents, CGPS_GET_LAG_PARENTS_DATA) < 0) {
 			logerr("failed load lagged variables (parents)");
 			return -1;
@@ -170,7 +259,7 @@ int cgps_predict_get_lag_parents(struct cgps_project *proj, int model, struct cg
 				char *buff = NULL;
 				size_t size = 0;
 				
-				if(!SQP_GetCompleteVariableLagNames(proj->handle, model, i + 1, 0, &names)) {
+				if(!SQP_GetCompleteVariableLagNames(proj->handle, model->number, i + 1, 0, &names)) {
 					logerr("failed get complete variable lag names (%s)", cgps_simcaq_error());
 					return 0;     /* not critical */
 				}
@@ -194,14 +283,11 @@ int cgps_predict_get_lag_parents(struct cgps_project *proj, int model, struct cg
   * Check if the project contains any qualitative data. These are the names 
   * of the qualitative variables whos data are needed as input for a prediction.
   */
-int cgps_predict_get_qual_data(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *names)
+int cgps_predict_get_qual_data(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred)
 {
+	SQX_StringVector *names = &model->qualnames;
 	int num;       /* number of elements in names */
 
-	if(!SQP_GetQualitativeNamesForPredict(proj->handle, model, names)) {
-		logerr("failed get names of the qualitative variables (%s)", cgps_simcaq_error());
-		return -1;
-	}
 	if((num = SQX_GetNumStringsInVector(names)) > 0) {
 		debug("there are %d qualitative variables in this model", num);
 	
@@ -209,17 +295,8 @@ int cgps_predict_get_qual_data(struct cgps_project *proj, int model, struct cgps
 		 * TODO: Check this code against SQPrepareForPredictionExample.c line 156.
 		 */
 		
-		if(pred->mqrawdata) {
-			free(pred->mqrawdata);
-		}
-		pred->mqrawdata = malloc(sizeof(SQX_StringMatrix));
-		if(!pred->mqrawdata) {
-			logerr("failed alloc memory");
-			return -1;
-		}
-		
 		if(proj->opts->indata(proj, pred->data, NULL, pred->mqrawdata, names, CGPS_GET_QUALITATIVE_DATA) < 0) {
-			logerr("failed load lagged variables (parents)");
+			logerr("failed load qualitative variables");
 			return -1;
 		}
 		
@@ -245,14 +322,11 @@ int cgps_predict_get_qual_data(struct cgps_project *proj, int model, struct cgps
  * are the names of the lagged qualitative variables whos data are needed as 
  * input for a prediction.
  */
-int cgps_predict_get_qual_data_lagged(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *names)
+int cgps_predict_get_qual_data_lagged(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred)
 {
+	SQX_StringVector *names = &model->qlagnames;
 	int num;
 	
-	if(!SQP_GetLagParentNamesForPredict(proj->handle, model, 1, names)) {
-		logerr("failed get names of lagged qualitative variables (%s)", cgps_simcaq_error());
-		return -1;
-	}
 	if((num = SQX_GetNumStringsInVector(names)) > 0) {
 		debug("there are %d lagged qualitative variables", num);
 		
@@ -260,17 +334,8 @@ int cgps_predict_get_qual_data_lagged(struct cgps_project *proj, int model, stru
 		 * TODO: Check this code against SQPrepareForPredictionExample.c line 209.
 		 */
 		
-		if(pred->mqrawdata) {
-			free(pred->mqrawdata);
-		}
-		pred->mqrawdata = malloc(sizeof(SQX_StringMatrix));
-		if(!pred->mqrawdata) {
-			logerr("failed alloc memory");
-			return -1;
-		}
-		
 		if(proj->opts->indata(proj, pred->data, NULL, pred->mqlagdata, names, CGPS_GET_QUAL_LAGGED_DATA) < 0) {
-			logerr("failed load lagged variables (parents)");
+			logerr("failed load lagged qualitative variables");
 			return -1;
 		}
 
@@ -282,7 +347,7 @@ int cgps_predict_get_qual_data_lagged(struct cgps_project *proj, int model, stru
 				char *buff = NULL;
 				size_t size = 0;
 				
-				if(!SQP_GetCompleteVariableLagNames(proj->handle, model, i + 1, 1, &lnn)) {
+				if(!SQP_GetCompleteVariableLagNames(proj->handle, model->number, i + 1, 1, &lnn)) {
 					logerr("failed get qualitative lag variable names (%s)", cgps_simcaq_error());
 					return 0;     /* not critical */
 				}
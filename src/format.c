@@ -0,0 +1,213 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Float to text conversion without printf(3). In shortest mode (digits == 0) 
+ * the number of significant digits is increased until the text converts back
+ * to the same float. Otherwise the value is rounded to the requested number 
+ * of significant digits (1-9). Trailing zeros are never printed.
+ * 
+ * The digits are computed in double precision, that has enough precision for 
+ * the 9 digits needed for round trip of any float.
+ */
+
+#define CGPS_FORMAT_MAX_DIGITS 9
+
+static const double cgps_format_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Return v * 10^exp.
+ */
+static double cgps_format_scale(double v, int exp)
+{
+	while(exp > 22) {
+		v *= 1e22;
+		exp -= 22;
+	}
+	while(exp < -22) {
+		v /= 1e22;
+		exp += 22;
+	}
+	return exp < 0 ? v / cgps_format_pow10[-exp] : v * cgps_format_pow10[exp];
+}
+
+/*
+ * Return the decimal exponent of v (v > 0), that is 10^exp <= v < 10^(exp + 1).
+ */
+static int cgps_format_exponent(double v)
+{
+	int exp = 0;
+	
+	while(v >= 1e16) {
+		v /= 1e16;
+		exp += 16;
+	}
+	while(v < 1) {
+		v *= 1e16;
+		exp -= 16;
+	}
+	while(v >= 10) {
+		v /= 10;
+		exp++;
+	}
+	return exp;
+}
+
+/*
+ * Compute the digits (as integer) of v rounded to prec significant digits.
+ * The exponent is adjusted if rounding adds a digit.
+ */
+static unsigned long cgps_format_digits(double v, int prec, int *exp)
+{
+	unsigned long m;
+	
+	m = (unsigned long)(cgps_format_scale(v, prec - 1 - *exp) + 0.5);
+	if(m >= (unsigned long)cgps_format_pow10[prec]) {
+		m /= 10;
+		(*exp)++;
+	} else if(m < (unsigned long)cgps_format_pow10[prec - 1]) {
+		m = (unsigned long)(cgps_format_scale(v, prec - *exp) + 0.5);
+		(*exp)--;
+	}
+	return m;
+}
+
+/*
+ * Format f in buff using digits significant digits (0 for shortest round
+ * trip representation). The buffer must have room for CGPS_FORMAT_FLOAT_MAX
+ * characters. Returns the length of the string. NaN and infinite values are
+ * written as null (as in JSON).
+ */
+int cgps_format_float(char *buff, float f, int digits)
+{
+	char str[CGPS_FORMAT_MAX_DIGITS + 1];
+	unsigned long m = 0;
+	double v;
+	int exp, prec, len, num, i;
+	char *p = buff;
+	
+	if(f != f || f - f != 0) {
+		memcpy(buff, "null", 5);
+		return 4;
+	}
+	if(f == 0) {
+		memcpy(buff, "0", 2);
+		return 1;
+	}
+	if(f < 0) {
+		*p++ = '-';
+		f = -f;
+	}
+	
+	v = f;
+	exp = cgps_format_exponent(v);
+	
+	if(digits <= 0 || digits > CGPS_FORMAT_MAX_DIGITS) {
+		for(prec = 1; prec <= CGPS_FORMAT_MAX_DIGITS; ++prec) {
+			int e = exp;
+			m = cgps_format_digits(v, prec, &e);
+			if((float)cgps_format_scale((double)m, e - prec + 1) == f) {
+				exp = e;
+				break;
+			}
+		}
+		if(prec > CGPS_FORMAT_MAX_DIGITS) {
+			prec = CGPS_FORMAT_MAX_DIGITS;
+			m = cgps_format_digits(v, prec, &exp);
+		}
+	} else {
+		prec = digits;
+		m = cgps_format_digits(v, prec, &exp);
+	}
+	
+	/*
+	 * Convert digits to string and strip trailing zeros.
+	 */
+	for(i = prec - 1; i >= 0; --i) {
+		str[i] = (char)('0' + m % 10);
+		m /= 10;
+	}
+	for(num = prec; num > 1 && str[num - 1] == '0'; --num) {
+		;
+	}
+	
+	if(exp >= -5 && exp < 15) {
+		if(exp < 0) {
+			*p++ = '0';
+			*p++ = '.';
+			for(i = -1; i > exp; --i) {
+				*p++ = '0';
+			}
+			for(i = 0; i < num; ++i) {
+				*p++ = str[i];
+			}
+		} else {
+			for(i = 0; i <= exp || i < num; ++i) {
+				if(i == exp + 1) {
+					*p++ = '.';
+				}
+				*p++ = i < num ? str[i] : '0';
+			}
+		}
+	} else {
+		*p++ = str[0];
+		if(num > 1) {
+			*p++ = '.';
+			for(i = 1; i < num; ++i) {
+				*p++ = str[i];
+			}
+		}
+		*p++ = 'e';
+		if(exp < 0) {
+			*p++ = '-';
+			exp = -exp;
+		}
+		if(exp >= 10) {
+			*p++ = (char)('0' + exp / 10);
+		}
+		*p++ = (char)('0' + exp % 10);
+	}
+	*p = '\0';
+	
+	len = p - buff;
+	return len;
+}
@@ -0,0 +1,282 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Numeric kernels for the native engine. All matrices are stored column by
+ * column. The kernels are compiled for each supported instruction set 
+ * (see kernel.h) and the best variant for the CPU is selected once when the
+ * library is loaded. 
+ */
+
+#define CGPS_KERNEL_TILE 16      /* tile size for transpose */
+
+/*
+ * All variants must give results identical to the scalar kernels, so the
+ * compiler must not contract multiply and add into FMA instructions (the GNU
+ * dialect default is -ffp-contract=fast).
+ */
+#if defined(__clang__)
+# pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+# pragma GCC optimize ("fp-contract=off")
+#endif
+
+/*
+ * Compute the scores for observations from, ..., n - 1 (scalar).
+ */
+static void cgps_kernel_scores_from(const float *x, int n, int k, const float *w, const float *t0, int a, float *t, int from)
+{
+	int i, j, c;
+	
+	for(c = 0; c < a; ++c) {
+		const float *wc = w + (size_t)c * k;
+		float *tc = t + (size_t)c * n;
+		
+		for(i = from; i < n; ++i) {
+			float s = t0[c];
+			
+			for(j = 0; j < k; ++j) {
+				s += wc[j] * x[(size_t)j * n + i];
+			}
+			tc[i] = s;
+		}
+	}
+}
+
+/*
+ * Compute the residuals for observations from, ..., n - 1 (scalar).
+ */
+static void cgps_kernel_residuals_from(const float *x, const float *t, int n, int k, int a, const float *q, const float *m, float *e, int from)
+{
+	int i, j, c;
+	
+	for(j = 0; j < k; ++j) {
+		const float *qj = q + (size_t)j * a;
+		
+		for(i = from; i < n; ++i) {
+			float s = x[(size_t)j * n + i] - m[j];
+			
+			for(c = 0; c < a; ++c) {
+				s -= qj[c] * t[(size_t)c * n + i];
+			}
+			e[(size_t)j * n + i] = s;
+		}
+	}
+}
+
+/*
+ * Compute the weighted sum of squares for observations from, ..., n - 1 
+ * (scalar).
+ */
+static void cgps_kernel_sumsq_from(const float *v, int n, const float *g, int c, float *s, int from)
+{
+	int i, j;
+	
+	for(i = from; i < n; ++i) {
+		float r = 0.0;
+		
+		for(j = 0; j < c; ++j) {
+			float vj = v[(size_t)j * n + i];
+			
+			r += g[j] * vj * vj;
+		}
+		s[i] = r;
+	}
+}
+
+static void cgps_kernel_scores_scalar(const float *x, int n, int k, const float *w, const float *t0, int a, float *t)
+{
+	cgps_kernel_scores_from(x, n, k, w, t0, a, t, 0);
+}
+
+static void cgps_kernel_residuals_scalar(const float *x, const float *t, int n, int k, int a, const float *q, const float *m, float *e)
+{
+	cgps_kernel_residuals_from(x, t, n, k, a, q, m, e, 0);
+}
+
+static void cgps_kernel_sumsq_scalar(const float *v, int n, const float *g, int c, float *s)
+{
+	cgps_kernel_sumsq_from(v, n, g, c, s, 0);
+}
+
+/*
+ * Transpose the rows x cols matrix src (row major) to dest (column major).
+ * The matrix is walked in tiles, so both the rows read and the columns 
+ * written stays in cache. Used by all variants.
+ */
+static void cgps_kernel_transpose(const float *src, int rows, int cols, float *dest)
+{
+	int i, j, ib, jb, im, jm;
+	
+	for(ib = 0; ib < rows; ib += CGPS_KERNEL_TILE) {
+		im = ib + CGPS_KERNEL_TILE < rows ? ib + CGPS_KERNEL_TILE : rows;
+		for(jb = 0; jb < cols; jb += CGPS_KERNEL_TILE) {
+			jm = jb + CGPS_KERNEL_TILE < cols ? jb + CGPS_KERNEL_TILE : cols;
+			for(j = jb; j < jm; ++j) {
+				for(i = ib; i < im; ++i) {
+					dest[(size_t)j * rows + i] = src[(size_t)i * cols + j];
+				}
+			}
+		}
+	}
+}
+
+static const struct cgps_kernel cgps_kernel_scalar = {
+	CGPS_KERNEL_SCALAR, "scalar",
+	cgps_kernel_scores_scalar, cgps_kernel_residuals_scalar, 
+	cgps_kernel_sumsq_scalar, cgps_kernel_transpose
+};
+
+#ifdef HAVE_CPU_DISPATCH
+
+#define CGPS_KERNEL_UNROLL 4
+
+typedef float cgps_kernel_v4sf __attribute__((vector_size(16), aligned(4), may_alias));
+typedef float cgps_kernel_v8sf __attribute__((vector_size(32), aligned(4), may_alias));
+typedef float cgps_kernel_v16sf __attribute__((vector_size(64), aligned(4), may_alias));
+
+#define CGPS_KERNEL_NAME(func) cgps_kernel_ ## func ## _sse42
+#define CGPS_KERNEL_TARGET __attribute__((target("sse4.2")))
+#define CGPS_KERNEL_VECTOR cgps_kernel_v4sf
+#define CGPS_KERNEL_WIDTH  4
+#include "kernel.h"
+#undef CGPS_KERNEL_NAME
+#undef CGPS_KERNEL_TARGET
+#undef CGPS_KERNEL_VECTOR
+#undef CGPS_KERNEL_WIDTH
+
+#define CGPS_KERNEL_NAME(func) cgps_kernel_ ## func ## _avx2
+#define CGPS_KERNEL_TARGET __attribute__((target("avx2")))
+#define CGPS_KERNEL_VECTOR cgps_kernel_v8sf
+#define CGPS_KERNEL_WIDTH  8
+#include "kernel.h"
+#undef CGPS_KERNEL_NAME
+#undef CGPS_KERNEL_TARGET
+#undef CGPS_KERNEL_VECTOR
+#undef CGPS_KERNEL_WIDTH
+
+#define CGPS_KERNEL_NAME(func) cgps_kernel_ ## func ## _avx512
+#define CGPS_KERNEL_TARGET __attribute__((target("avx512f")))
+#define CGPS_KERNEL_VECTOR cgps_kernel_v16sf
+#define CGPS_KERNEL_WIDTH  16
+#include "kernel.h"
+#undef CGPS_KERNEL_NAME
+#undef CGPS_KERNEL_TARGET
+#undef CGPS_KERNEL_VECTOR
+#undef CGPS_KERNEL_WIDTH
+
+static const struct cgps_kernel cgps_kernel_sse42 = {
+	CGPS_KERNEL_SSE42, "sse4.2",
+	cgps_kernel_scores_sse42, cgps_kernel_residuals_sse42, 
+	cgps_kernel_sumsq_sse42, cgps_kernel_transpose
+};
+
+static const struct cgps_kernel cgps_kernel_avx2 = {
+	CGPS_KERNEL_AVX2, "avx2",
+	cgps_kernel_scores_avx2, cgps_kernel_residuals_avx2, 
+	cgps_kernel_sumsq_avx2, cgps_kernel_transpose
+};
+
+static const struct cgps_kernel cgps_kernel_avx512 = {
+	CGPS_KERNEL_AVX512, "avx512f",
+	cgps_kernel_scores_avx512, cgps_kernel_residuals_avx512, 
+	cgps_kernel_sumsq_avx512, cgps_kernel_transpose
+};
+
+#endif /* HAVE_CPU_DISPATCH */
+
+/*
+ * The active kernels.
+ */
+const struct cgps_kernel *cgps_kernel = &cgps_kernel_scalar;
+
+/*
+ * Get kernels for variant (one of CGPS_KERNEL_XXX) if supported by this 
+ * library and CPU. Returns NULL if unsupported.
+ */
+static const struct cgps_kernel * cgps_kernel_find(int variant)
+{
+	switch(variant) {
+	case CGPS_KERNEL_SCALAR:
+		return &cgps_kernel_scalar;
+#ifdef HAVE_CPU_DISPATCH
+	case CGPS_KERNEL_SSE42:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.2") ? &cgps_kernel_sse42 : NULL;
+	case CGPS_KERNEL_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? &cgps_kernel_avx2 : NULL;
+	case CGPS_KERNEL_AVX512:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx512f") ? &cgps_kernel_avx512 : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Select the kernel variant. Returns -1 if not supported by this library or
+ * CPU. This is not thread safe, the variant is normally selected once when 
+ * the library is loaded.
+ */
+int cgps_kernel_select(int variant)
+{
+	const struct cgps_kernel *kernel = cgps_kernel_find(variant);
+	
+	if(!kernel) {
+		return -1;
+	}
+	cgps_kernel = kernel;
+	return 0;
+}
+
+#ifdef HAVE_CPU_DISPATCH
+/*
+ * Select the best variant for the CPU when the library is loaded.
+ */
+static void cgps_kernel_init(void) __attribute__((constructor));
+
+static void cgps_kernel_init(void)
+{
+	int variant;
+	
+	for(variant = CGPS_KERNEL_AVX512; variant > CGPS_KERNEL_SCALAR; --variant) {
+		if(cgps_kernel_select(variant) == 0) {
+			break;
+		}
+	}
+}
+#endif /* HAVE_CPU_DISPATCH */
@@ -0,0 +1,174 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+/*
+ * Template for the numeric kernels of the native engine. This file is 
+ * included by kernel.c once for each vector instruction set, having defined:
+ * 
+ *   CGPS_KERNEL_NAME(func)  name of the kernel function in this variant
+ *   CGPS_KERNEL_TARGET      target attribute for the instruction set
+ *   CGPS_KERNEL_VECTOR      unaligned vector type of CGPS_KERNEL_WIDTH floats
+ *   CGPS_KERNEL_WIDTH       number of floats in a vector
+ * 
+ * The vector loops handle CGPS_KERNEL_UNROLL vectors of observations at once 
+ * for having independent sums in flight. The remaining observations are 
+ * handled by the scalar kernels. Each value is computed in the same order as
+ * by the scalar kernels (no fused multiply-add), so all variants gives the
+ * same result.
+ */
+
+/*
+ * Compute the scores t (n x a) for the observations x (n x k).
+ */
+CGPS_KERNEL_TARGET
+static void CGPS_KERNEL_NAME(scores)(const float *x, int n, int k, const float *w, const float *t0, int a, float *t)
+{
+	const CGPS_KERNEL_VECTOR zero = { 0 };
+	CGPS_KERNEL_VECTOR s0, s1, s2, s3;
+	const float *xj, *wc;
+	float *tc;
+	int i, j, c;
+	
+	for(i = 0; i + CGPS_KERNEL_UNROLL * CGPS_KERNEL_WIDTH <= n; i += CGPS_KERNEL_UNROLL * CGPS_KERNEL_WIDTH) {
+		for(c = 0; c < a; ++c) {
+			wc = w + (size_t)c * k;
+			s0 = s1 = s2 = s3 = zero + t0[c];
+			for(j = 0; j < k; ++j) {
+				xj = x + (size_t)j * n + i;
+				s0 += wc[j] * *(const CGPS_KERNEL_VECTOR *)(xj);
+				s1 += wc[j] * *(const CGPS_KERNEL_VECTOR *)(xj + CGPS_KERNEL_WIDTH);
+				s2 += wc[j] * *(const CGPS_KERNEL_VECTOR *)(xj + 2 * CGPS_KERNEL_WIDTH);
+				s3 += wc[j] * *(const CGPS_KERNEL_VECTOR *)(xj + 3 * CGPS_KERNEL_WIDTH);
+			}
+			tc = t + (size_t)c * n + i;
+			*(CGPS_KERNEL_VECTOR *)(tc) = s0;
+			*(CGPS_KERNEL_VECTOR *)(tc + CGPS_KERNEL_WIDTH) = s1;
+			*(CGPS_KERNEL_VECTOR *)(tc + 2 * CGPS_KERNEL_WIDTH) = s2;
+			*(CGPS_KERNEL_VECTOR *)(tc + 3 * CGPS_KERNEL_WIDTH) = s3;
+		}
+	}
+	for(; i + CGPS_KERNEL_WIDTH <= n; i += CGPS_KERNEL_WIDTH) {
+		for(c = 0; c < a; ++c) {
+			wc = w + (size_t)c * k;
+			s0 = zero + t0[c];
+			for(j = 0; j < k; ++j) {
+				s0 += wc[j] * *(const CGPS_KERNEL_VECTOR *)(x + (size_t)j * n + i);
+			}
+			*(CGPS_KERNEL_VECTOR *)(t + (size_t)c * n + i) = s0;
+		}
+	}
+	cgps_kernel_scores_from(x, n, k, w, t0, a, t, i);
+}
+
+/*
+ * Compute the residuals e (n x k) of the observations x (n x k) having the 
+ * scores t (n x a).
+ */
+CGPS_KERNEL_TARGET
+static void CGPS_KERNEL_NAME(residuals)(const float *x, const float *t, int n, int k, int a, const float *q, const float *m, float *e)
+{
+	CGPS_KERNEL_VECTOR s0, s1, s2, s3;
+	const float *xj, *tc, *qj;
+	float *ej;
+	int i, j, c;
+	
+	for(i = 0; i + CGPS_KERNEL_UNROLL * CGPS_KERNEL_WIDTH <= n; i += CGPS_KERNEL_UNROLL * CGPS_KERNEL_WIDTH) {
+		for(j = 0; j < k; ++j) {
+			xj = x + (size_t)j * n + i;
+			qj = q + (size_t)j * a;
+			s0 = *(const CGPS_KERNEL_VECTOR *)(xj) - m[j];
+			s1 = *(const CGPS_KERNEL_VECTOR *)(xj + CGPS_KERNEL_WIDTH) - m[j];
+			s2 = *(const CGPS_KERNEL_VECTOR *)(xj + 2 * CGPS_KERNEL_WIDTH) - m[j];
+			s3 = *(const CGPS_KERNEL_VECTOR *)(xj + 3 * CGPS_KERNEL_WIDTH) - m[j];
+			for(c = 0; c < a; ++c) {
+				tc = t + (size_t)c * n + i;
+				s0 -= qj[c] * *(const CGPS_KERNEL_VECTOR *)(tc);
+				s1 -= qj[c] * *(const CGPS_KERNEL_VECTOR *)(tc + CGPS_KERNEL_WIDTH);
+				s2 -= qj[c] * *(const CGPS_KERNEL_VECTOR *)(tc + 2 * CGPS_KERNEL_WIDTH);
+				s3 -= qj[c] * *(const CGPS_KERNEL_VECTOR *)(tc + 3 * CGPS_KERNEL_WIDTH);
+			}
+			ej = e + (size_t)j * n + i;
+			*(CGPS_KERNEL_VECTOR *)(ej) = s0;
+			*(CGPS_KERNEL_VECTOR *)(ej + CGPS_KERNEL_WIDTH) = s1;
+			*(CGPS_KERNEL_VECTOR *)(ej + 2 * CGPS_KERNEL_WIDTH) = s2;
+			*(CGPS_KERNEL_VECTOR *)(ej + 3 * CGPS_KERNEL_WIDTH) = s3;
+		}
+	}
+	for(; i + CGPS_KERNEL_WIDTH <= n; i += CGPS_KERNEL_WIDTH) {
+		for(j = 0; j < k; ++j) {
+			qj = q + (size_t)j * a;
+			s0 = *(const CGPS_KERNEL_VECTOR *)(x + (size_t)j * n + i) - m[j];
+			for(c = 0; c < a; ++c) {
+				s0 -= qj[c] * *(const CGPS_KERNEL_VECTOR *)(t + (size_t)c * n + i);
+			}
+			*(CGPS_KERNEL_VECTOR *)(e + (size_t)j * n + i) = s0;
+		}
+	}
+	cgps_kernel_residuals_from(x, t, n, k, a, q, m, e, i);
+}
+
+/*
+ * Compute the weighted sum of squares s[i] = sum(g[j] * v[i][j]^2) for the
+ * n x c matrix v.
+ */
+CGPS_KERNEL_TARGET
+static void CGPS_KERNEL_NAME(sumsq)(const float *v, int n, const float *g, int c, float *s)
+{
+	const CGPS_KERNEL_VECTOR zero = { 0 };
+	CGPS_KERNEL_VECTOR s0, s1, s2, s3, v0, v1, v2, v3;
+	const float *vj;
+	int i, j;
+	
+	for(i = 0; i + CGPS_KERNEL_UNROLL * CGPS_KERNEL_WIDTH <= n; i += CGPS_KERNEL_UNROLL * CGPS_KERNEL_WIDTH) {
+		s0 = s1 = s2 = s3 = zero;
+		for(j = 0; j < c; ++j) {
+			vj = v + (size_t)j * n + i;
+			v0 = *(const CGPS_KERNEL_VECTOR *)(vj);
+			v1 = *(const CGPS_KERNEL_VECTOR *)(vj + CGPS_KERNEL_WIDTH);
+			v2 = *(const CGPS_KERNEL_VECTOR *)(vj + 2 * CGPS_KERNEL_WIDTH);
+			v3 = *(const CGPS_KERNEL_VECTOR *)(vj + 3 * CGPS_KERNEL_WIDTH);
+			s0 += g[j] * v0 * v0;
+			s1 += g[j] * v1 * v1;
+			s2 += g[j] * v2 * v2;
+			s3 += g[j] * v3 * v3;
+		}
+		*(CGPS_KERNEL_VECTOR *)(s + i) = s0;
+		*(CGPS_KERNEL_VECTOR *)(s + i + CGPS_KERNEL_WIDTH) = s1;
+		*(CGPS_KERNEL_VECTOR *)(s + i + 2 * CGPS_KERNEL_WIDTH) = s2;
+		*(CGPS_KERNEL_VECTOR *)(s + i + 3 * CGPS_KERNEL_WIDTH) = s3;
+	}
+	for(; i + CGPS_KERNEL_WIDTH <= n; i += CGPS_KERNEL_WIDTH) {
+		s0 = zero;
+		for(j = 0; j < c; ++j) {
+			v0 = *(const CGPS_KERNEL_VECTOR *)(v + (size_t)j * n + i);
+			s0 += g[j] * v0 * v0;
+		}
+		*(CGPS_KERNEL_VECTOR *)(s + i) = s0;
+	}
+	cgps_kernel_sumsq_from(v, n, g, c, s, i);
+}
@@ -0,0 +1,601 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Memory mapped model files. The model metadata, variable names and native 
+ * engine parameters of a loaded project are exported to a file that is later 
+ * mapped read-only by cgps_project_load_mapped(). The parameters are used 
+ * direct from the mapping, so all processes on a node shares the same pages
+ * and no SIMCA-QP project is loaded.
+ * 
+ * The file starts with a header and one directory entry for each model, 
+ * followed by the project name and variable names (nul terminated strings).
+ * The parameters of each model starts on a page boundary with each vector 
+ * aligned for the numeric kernels. All offsets are bytes from start of file
+ * (0 for missing values). The values are stored in host byte order, the 
+ * header records the byte order and type sizes of the exporting host.
+ */
+
+#define CGPS_MAPPED_MAGIC   "CGPSMAP"
+#define CGPS_MAPPED_VERSION 1
+#define CGPS_MAPPED_ORDER   0x01020304
+#define CGPS_MAPPED_SIZES   (sizeof(int) | sizeof(float) << 8 | sizeof(double) << 16)
+#define CGPS_MAPPED_ALIGN   4096         /* alignment of model parameters */
+
+struct cgps_mapped_header
+{
+	char magic[8];              /* CGPS_MAPPED_MAGIC */
+	int version;                /* CGPS_MAPPED_VERSION */
+	int order;                  /* CGPS_MAPPED_ORDER in host byte order */
+	int sizes;                  /* CGPS_MAPPED_SIZES */
+	int size;                   /* size of file */
+	int models;                 /* number of models */
+	int name;                   /* project name */
+	int isreduced;              /* project is a reduced project (*.rusp) */
+	int isdatainc;              /* primary data set is included */
+	int isresuinc;              /* model residuals is included */
+};
+
+struct cgps_mapped_model
+{
+	int number;                 /* model number */
+	int fitted;                 /* model is fitted */
+	int numcomp;                /* number of components */
+	int type;                   /* model type (SQX_ModelType) */
+	int nvars;                  /* number of quantitative variables (K) */
+	int varnames;               /* K variable names */
+	int native;                 /* native parameters included */
+	int ncomp;                  /* number of components (A) */
+	int nyvars;                 /* number of Y variables (M) */
+	int tobs, t2obs, robs, dobs, pobs, cobs, yobs;
+	double df1;                 /* degrees of freedom for PModX */
+	double df2;
+	int weights;                /* K x A */
+	int offset;                 /* A */
+	int t2scale;                /* A */
+	int loadings;               /* A x K */
+	int center;                 /* K */
+	int dmodx;                  /* K */
+	int contrib;                /* K */
+	int coefs;                  /* K x M */
+	int yoffset;                /* M */
+};
+
+/*
+ * Layout of the exported file. The layout is computed twice, first without
+ * a buffer for getting the file size.
+ */
+struct cgps_mapped_writer
+{
+	char *base;                 /* file buffer (NULL when measuring) */
+	size_t pos;                 /* current size */
+};
+
+/*
+ * Append size bytes from src at the next offset aligned on align. Returns
+ * the offset (0 if src is NULL).
+ */
+static int cgps_mapped_put(struct cgps_mapped_writer *w, const void *src, size_t size, size_t align)
+{
+	size_t pos;
+	
+	if(!src) {
+		return 0;
+	}
+	pos = (w->pos + align - 1) / align * align;
+	if(w->base) {
+		memcpy(w->base + pos, src, size);
+	}
+	w->pos = pos + size;
+	return (int)pos;
+}
+
+static int cgps_mapped_put_floats(struct cgps_mapped_writer *w, const float *src, int count)
+{
+	return cgps_mapped_put(w, src, (size_t)count * sizeof(float), CGPS_MATRIX_ALIGN);
+}
+
+/*
+ * Check if model can be exported with its native parameters.
+ */
+static int cgps_mapped_exportable(struct cgps_model *model)
+{
+	return model->native && 
+		SQX_GetNumStringsInVector(&model->lagparents) == 0 && 
+		SQX_GetNumStringsInVector(&model->qualnames) == 0 &&
+		SQX_GetNumStringsInVector(&model->qlagnames) == 0;
+}
+
+/*
+ * Layout the models from first to last (index) in the file buffer.
+ */
+static int cgps_mapped_layout(struct cgps_project *proj, int first, int last, struct cgps_mapped_writer *w)
+{
+	struct cgps_mapped_header header;
+	struct cgps_mapped_model entry;
+	struct cgps_mapped_model *dir;
+	int i, j;
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CGPS_MAPPED_MAGIC, sizeof(CGPS_MAPPED_MAGIC));
+	header.version = CGPS_MAPPED_VERSION;
+	header.order = CGPS_MAPPED_ORDER;
+	header.sizes = CGPS_MAPPED_SIZES;
+	header.models = last - first + 1;
+	header.isreduced = proj->isreduced;
+	header.isdatainc = proj->isdatainc;
+	header.isresuinc = proj->isresuinc;
+	
+	w->pos = sizeof(header) + header.models * sizeof(struct cgps_mapped_model);
+	dir = w->base ? (struct cgps_mapped_model *)(w->base + sizeof(header)) : NULL;
+	
+	if(proj->name) {
+		header.name = cgps_mapped_put(w, proj->name, strlen(proj->name) + 1, 1);
+	}
+	
+	for(i = first; i <= last; ++i) {
+		struct cgps_model *model = &proj->model[i - 1];
+		
+		memset(&entry, 0, sizeof(entry));
+		entry.number = model->number;
+		entry.fitted = model->fitted;
+		entry.numcomp = model->numcomp;
+		entry.type = model->type;
+		
+		if(cgps_mapped_exportable(model)) {
+			entry.nvars = SQX_GetNumStringsInVector(&model->varnames);
+			for(j = 0; j < entry.nvars; ++j) {
+				const char *str;
+				int pos;
+				
+				if(!SQX_GetStringFromVector(&model->varnames, j + 1, &str)) {
+					logerr("failed get string from vector (%s)", cgps_simcaq_error());
+					return -1;
+				}
+				pos = cgps_mapped_put(w, str, strlen(str) + 1, 1);
+				if(j == 0) {
+					entry.varnames = pos;
+				}
+			}
+		}
+		if(w->base) {
+			memcpy(dir + (i - first), &entry, sizeof(entry));
+		}
+	}
+	
+	for(i = first; i <= last; ++i) {
+		struct cgps_model *model = &proj->model[i - 1];
+		struct cgps_native *native = model->native;
+		int k, a, m;
+		
+		if(!cgps_mapped_exportable(model)) {
+			debug("model %d is exported without native parameters", model->number);
+			continue;
+		}
+		k = native->nvars;
+		a = native->ncomp;
+		m = native->nyvars;
+		
+		w->pos = (w->pos + CGPS_MAPPED_ALIGN - 1) / CGPS_MAPPED_ALIGN * CGPS_MAPPED_ALIGN;
+		
+		memset(&entry, 0, sizeof(entry));
+		if(w->base) {
+			memcpy(&entry, dir + (i - first), sizeof(entry));
+		}
+		entry.native = 1;
+		entry.nvars = k;
+		entry.ncomp = a;
+		entry.nyvars = m;
+		entry.tobs = native->tobs;
+		entry.t2obs = native->t2obs;
+		entry.robs = native->robs;
+		entry.dobs = native->dobs;
+		entry.pobs = native->pobs;
+		entry.cobs = native->cobs;
+		entry.yobs = native->yobs;
+		entry.df1 = native->df1;
+		entry.df2 = native->df2;
+		entry.weights = cgps_mapped_put_floats(w, native->weights, k * a);
+		entry.offset = cgps_mapped_put_floats(w, native->offset, a);
+		entry.t2scale = cgps_mapped_put_floats(w, native->t2scale, a);
+		entry.loadings = cgps_mapped_put_floats(w, native->loadings, a * k);
+		entry.center = cgps_mapped_put_floats(w, native->center, k);
+		entry.dmodx = cgps_mapped_put_floats(w, native->dmodx, k);
+		entry.contrib = cgps_mapped_put_floats(w, native->contrib, k);
+		entry.coefs = cgps_mapped_put_floats(w, native->coefs, k * m);
+		entry.yoffset = cgps_mapped_put_floats(w, native->yoffset, m);
+		if(w->base) {
+			memcpy(dir + (i - first), &entry, sizeof(entry));
+		}
+	}
+	
+	header.size = (int)w->pos;
+	if(w->base) {
+		memcpy(w->base, &header, sizeof(header));
+	}
+	return 0;
+}
+
+/*
+ * Export the model at index (all models if index is 0) to the file path.
+ */
+int cgps_model_export(struct cgps_project *proj, int index, const char *path)
+{
+	struct cgps_mapped_writer w;
+	char *temp;
+	FILE *fp;
+	int first = 1, last = proj->models, i;
+	
+	if(index != 0) {
+		if(!cgps_project_model_index(proj, index)) {
+			return -1;
+		}
+		first = last = index;
+	}
+	if(first > last) {
+		logerr("project has no models to export");
+		return -1;
+	}
+	
+	/*
+	 * Load the models (lazy mode) and derive the native parameters for 
+	 * models loaded without them.
+	 */
+	for(i = first; i <= last; ++i) {
+		struct cgps_model *model;
+		
+		if(!(model = cgps_project_model_index(proj, i))) {
+			return -1;
+		}
+		if(proj->handle && model->fitted && !model->native) {
+			if(cgps_native_load(proj, model) < 0) {
+				logwarn("model %d is not supported by the native engine", model->number);
+			}
+		}
+	}
+	
+	memset(&w, 0, sizeof(w));
+	if(cgps_mapped_layout(proj, first, last, &w) < 0) {
+		return -1;
+	}
+	if(w.pos > 0x7fffffff) {
+		logerr("model file would be too large (%lu bytes)", (unsigned long)w.pos);
+		return -1;
+	}
+	if(!(w.base = calloc(1, w.pos))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	if(cgps_mapped_layout(proj, first, last, &w) < 0) {
+		free(w.base);
+		return -1;
+	}
+	
+	/*
+	 * Write to temporary file and rename it, so processes having the old 
+	 * file mapped are not affected.
+	 */
+	if(!(temp = malloc(strlen(path) + 5))) {
+		logerr("failed alloc memory");
+		free(w.base);
+		return -1;
+	}
+	sprintf(temp, "%s.tmp", path);
+	
+	if(!(fp = fopen(temp, "wb"))) {
+		logerr("failed open %s for writing", temp);
+		free(temp);
+		free(w.base);
+		return -1;
+	}
+	i = fwrite(w.base, 1, w.pos, fp) == w.pos ? 0 : -1;
+	if(fclose(fp) != 0) {
+		i = -1;
+	}
+	if(i < 0) {
+		logerr("failed write model file %s", temp);
+		remove(temp);
+		free(temp);
+		free(w.base);
+		return -1;
+	}
+	if(rename(temp, path) != 0) {
+		logerr("failed rename %s to %s", temp, path);
+		remove(temp);
+		free(temp);
+		free(w.base);
+		return -1;
+	}
+	
+	debug("exported %d models (%lu bytes) to %s", last - first + 1, (unsigned long)w.pos, path);
+	free(temp);
+	free(w.base);
+	return 0;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+
+/*
+ * Get rows * cols floats at offset in the mapped file. Returns -1 if outside
+ * the file or misaligned. The size is computed in size_t and checked against
+ * the file size before multiplying, as the dimensions are read from the file.
+ */
+static int cgps_mapped_floats(struct cgps_project *proj, int offset, int rows, int cols, float **dest)
+{
+	const char *base = proj->mapped;
+	size_t avail;
+	
+	*dest = NULL;
+	if(offset == 0) {
+		return 0;
+	}
+	if(offset < 0 || rows < 0 || cols < 0 || offset % sizeof(float) != 0 || 
+	   (size_t)offset > proj->mapsize) {
+		logerr("invalid vector in model file (offset %d, %dx%d values)", offset, rows, cols);
+		return -1;
+	}
+	avail = (proj->mapsize - offset) / sizeof(float);
+	if(cols != 0 && (size_t)rows > avail / (size_t)cols) {
+		logerr("invalid vector in model file (offset %d, %dx%d values)", offset, rows, cols);
+		return -1;
+	}
+	*dest = (float *)(base + offset);
+	return 0;
+}
+
+/*
+ * Get the nul terminated string at offset in the mapped file. Returns NULL
+ * if outside the file.
+ */
+static const char * cgps_mapped_string(struct cgps_project *proj, int offset)
+{
+	const char *base = proj->mapped;
+	
+	if(offset <= 0 || (size_t)offset >= proj->mapsize ||
+	   !memchr(base + offset, 0, proj->mapsize - offset)) {
+		logerr("invalid string in model file (offset %d)", offset);
+		return NULL;
+	}
+	return base + offset;
+}
+
+/*
+ * Setup model descriptor from directory entry.
+ */
+static int cgps_mapped_model(struct cgps_project *proj, int index, const struct cgps_mapped_model *entry, struct cgps_model *model)
+{
+	struct cgps_native *native;
+	const char *str;
+	int i, pos;
+	
+	model->index = index;
+	model->state = CGPS_MODEL_LOADED;
+	model->number = entry->number;
+	model->fitted = entry->fitted;
+	model->numcomp = entry->numcomp;
+	model->type = (SQX_ModelType)entry->type;
+	
+	if(entry->nvars > 0) {
+		if(!SQX_InitStringVector(&model->varnames, entry->nvars)) {
+			logerr("failed initilize string vector (%s)", cgps_simcaq_error());
+			return -1;
+		}
+		for(i = 0, pos = entry->varnames; i < entry->nvars; ++i) {
+			if(!(str = cgps_mapped_string(proj, pos))) {
+				return -1;
+			}
+			pos += strlen(str) + 1;
+			if(!SQX_SetStringInVector(&model->varnames, i + 1, str)) {
+				logerr("failed set string in vector (%s)", cgps_simcaq_error());
+				return -1;
+			}
+		}
+	}
+	if(!entry->native) {
+		debug("model %d has no native parameters in model file", model->number);
+		return 0;
+	}
+	
+	if(entry->nvars <= 0 || entry->ncomp < 0 || entry->nyvars < 0) {
+		logerr("invalid parameters for model %d in model file", model->number);
+		return -1;
+	}
+	if(!(native = calloc(1, sizeof(struct cgps_native)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	native->mapped = 1;
+	native->nvars = entry->nvars;
+	native->ncomp = entry->ncomp;
+	native->nyvars = entry->nyvars;
+	native->tobs = entry->tobs;
+	native->t2obs = entry->t2obs;
+	native->robs = entry->robs;
+	native->dobs = entry->dobs;
+	native->pobs = entry->pobs;
+	native->cobs = entry->cobs;
+	native->yobs = entry->yobs;
+	native->df1 = entry->df1;
+	native->df2 = entry->df2;
+	model->native = native;
+	
+	if(cgps_mapped_floats(proj, entry->weights, entry->nvars, entry->ncomp, &native->weights) < 0 ||
+	   cgps_mapped_floats(proj, entry->offset, entry->ncomp, 1, &native->offset) < 0 ||
+	   cgps_mapped_floats(proj, entry->t2scale, entry->ncomp, 1, &native->t2scale) < 0 ||
+	   cgps_mapped_floats(proj, entry->loadings, entry->ncomp, entry->nvars, &native->loadings) < 0 ||
+	   cgps_mapped_floats(proj, entry->center, entry->nvars, 1, &native->center) < 0 ||
+	   cgps_mapped_floats(proj, entry->dmodx, entry->nvars, 1, &native->dmodx) < 0 ||
+	   cgps_mapped_floats(proj, entry->contrib, entry->nvars, 1, &native->contrib) < 0 ||
+	   cgps_mapped_floats(proj, entry->coefs, entry->nvars, entry->nyvars, &native->coefs) < 0 ||
+	   cgps_mapped_floats(proj, entry->yoffset, entry->nyvars, 1, &native->yoffset) < 0) {
+		return -1;
+	}
+	if(!native->weights || !native->offset) {
+		logerr("missing score weights for model %d in model file", model->number);
+		return -1;
+	}
+	if(native->coefs && !native->yoffset) {
+		logerr("missing Y offset for model %d in model file", model->number);
+		return -1;
+	}
+	
+	debug("mapped native parameters for model %d (%d variables, %d components)", 
+	      model->number, native->nvars, native->ncomp);
+	return 0;
+}
+
+/*
+ * Map the model file in path and setup the model descriptors of proj. 
+ */
+int cgps_mapped_open(struct cgps_project *proj, const char *path)
+{
+	const struct cgps_mapped_header *header;
+	const struct cgps_mapped_model *dir;
+	struct stat st;
+	void *addr;
+	int fd, i;
+	
+	if((fd = open(path, O_RDONLY)) < 0) {
+		logerr("failed open model file %s", path);
+		return -1;
+	}
+	if(fstat(fd, &st) < 0) {
+		logerr("failed stat model file %s", path);
+		close(fd);
+		return -1;
+	}
+	if((size_t)st.st_size < sizeof(struct cgps_mapped_header)) {
+		logerr("model file %s is truncated", path);
+		close(fd);
+		return -1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED) {
+		logerr("failed map model file %s", path);
+		return -1;
+	}
+	proj->mapped = addr;
+	proj->mapsize = st.st_size;
+	
+	header = addr;
+	if(memcmp(header->magic, CGPS_MAPPED_MAGIC, sizeof(CGPS_MAPPED_MAGIC)) != 0) {
+		logerr("%s is not a model file", path);
+		return -1;
+	}
+	if(header->version != CGPS_MAPPED_VERSION) {
+		logerr("unsupported version %d of model file %s", header->version, path);
+		return -1;
+	}
+	if(header->order != CGPS_MAPPED_ORDER || header->sizes != (int)CGPS_MAPPED_SIZES) {
+		logerr("model file %s was exported on an incompatible host", path);
+		return -1;
+	}
+	if(header->size != (int)proj->mapsize || header->models < 0 ||
+	   (size_t)header->models > (proj->mapsize - sizeof(*header)) / sizeof(*dir)) {
+		logerr("model file %s is truncated", path);
+		return -1;
+	}
+	
+	proj->models = header->models;
+	proj->isreduced = header->isreduced;
+	proj->isdatainc = header->isdatainc;
+	proj->isresuinc = header->isresuinc;
+	if(header->name) {
+		if(!(proj->name = (char *)cgps_mapped_string(proj, header->name))) {
+			return -1;
+		}
+	}
+	
+	if(proj->models > 0) {
+		if(!(proj->model = calloc(proj->models, sizeof(struct cgps_model)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		dir = (const struct cgps_mapped_model *)(header + 1);
+		for(i = 0; i < proj->models; ++i) {
+			if(cgps_mapped_model(proj, i + 1, &dir[i], &proj->model[i]) < 0) {
+				logerr("failed load model index %d from %s", i + 1, path);
+				return -1;
+			}
+		}
+	}
+	
+	debug("mapped model file %s (%d models, %lu bytes)", path, proj->models, (unsigned long)proj->mapsize);
+	return 0;
+}
+
+/*
+ * Unmap the model file.
+ */
+void cgps_mapped_close(struct cgps_project *proj)
+{
+	if(proj->mapped) {
+		munmap(proj->mapped, proj->mapsize);
+		proj->mapped = NULL;
+		proj->mapsize = 0;
+	}
+}
+
+#else /* ! HAVE_SYS_MMAN_H */
+
+int cgps_mapped_open(struct cgps_project *proj, const char *path)
+{
+	logerr("memory mapped model files are not supported on this platform");
+	return -1;
+}
+
+void cgps_mapped_close(struct cgps_project *proj)
+{
+}
+
+#endif /* HAVE_SYS_MMAN_H */
@@ -0,0 +1,136 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Plain float matrices used internal by the library. The values are stored
+ * column by column in one aligned buffer, so the formatters (and numeric
+ * code) works on ordinary memory instead of calling SIMCA-QP for each value.
+ */
+
+/*
+ * Allocate matrix for rows x cols values. Returns -1 on failure.
+ */
+int cgps_matrix_alloc(struct cgps_matrix *matrix, int rows, int cols)
+{
+	void *data = NULL;
+	size_t size = (size_t)rows * cols * sizeof(float);
+	
+	matrix->data = NULL;
+	matrix->rows = 0;
+	matrix->cols = 0;
+	matrix->size = 0;
+	
+	if(posix_memalign(&data, CGPS_MATRIX_ALIGN, size ? size : sizeof(float)) != 0) {
+		return -1;
+	}
+	matrix->data = data;
+	matrix->rows = rows;
+	matrix->cols = cols;
+	matrix->size = (size_t)rows * cols;
+	return 0;
+}
+
+/*
+ * Resize matrix (allocated or zero filled) to rows x cols values. The memory
+ * is reused if large enough, otherwise reallocated. The values are undefined
+ * after resize. Returns -1 on failure.
+ */
+int cgps_matrix_resize(struct cgps_matrix *matrix, int rows, int cols)
+{
+	if(matrix->data && (size_t)rows * cols <= matrix->size) {
+		matrix->rows = rows;
+		matrix->cols = cols;
+		return 0;
+	}
+	cgps_matrix_free(matrix);
+	return cgps_matrix_alloc(matrix, rows, cols);
+}
+
+/*
+ * Release memory used by matrix.
+ */
+void cgps_matrix_free(struct cgps_matrix *matrix)
+{
+	if(matrix->data) {
+		free(matrix->data);
+		matrix->data = NULL;
+	}
+	matrix->rows = 0;
+	matrix->cols = 0;
+	matrix->size = 0;
+}
+
+/*
+ * Copy all values in the SIMCA-QP matrix src to data (column by column). The
+ * data must have room for all values. Returns -1 on failure.
+ */
+int cgps_matrix_read(struct cgps_project *proj, SQX_FloatMatrix *src, float *data)
+{
+	int i, j, rows, cols;
+	
+	cols = SQX_GetNumColumnsInFloatMatrix(src);
+	rows = SQX_GetNumRowsInFloatMatrix(src);
+	
+	for(i = 0; i < cols; ++i) {
+		for(j = 0; j < rows; ++j) {
+			if(!SQX_GetDataFromFloatMatrix(src, j + 1, i + 1, data++)) {
+				logerr("failed get float value from matrix (%s)", cgps_simcaq_error());
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Copy all values in the SIMCA-QP matrix src to dest in one pass. The dest 
+ * matrix is allocated by this function. Returns -1 on failure.
+ */
+int cgps_matrix_extract(struct cgps_project *proj, SQX_FloatMatrix *src, struct cgps_matrix *dest)
+{
+	if(cgps_matrix_alloc(dest, SQX_GetNumRowsInFloatMatrix(src), SQX_GetNumColumnsInFloatMatrix(src)) < 0) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	if(cgps_matrix_read(proj, src, dest->data) < 0) {
+		cgps_matrix_free(dest);
+		return -1;
+	}
+	return 0;
+}
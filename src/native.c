@@ -0,0 +1,1356 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#include <math.h>
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * The native prediction engine. The SIMCA-QP C interface don't give access 
+ * to the centering, scaling and loading vectors of a model, but the predicted 
+ * scores, the (unscaled) residuals and the predicted Y of a model without 
+ * transformed variables are affine functions of the raw observation data:
+ * 
+ *   t = x * W + t0
+ *   e = x - (t * Q + m)
+ *   y = x * B + y0          (PLS models)
+ * 
+ * These parameters are recovered once (when the project is loaded) by 
+ * predicting a batch of probe observations (the origin and one step along 
+ * each variable) using SIMCA-QP. The Hotelling T2, DModX and the DModX 
+ * contributions are diagonal weightings of the scores and residuals, the 
+ * weights are solved from the same probe. The degrees of freedom of the F 
+ * distribution used for PModX is calibrated by a second probe having DModX 
+ * in the range 0.25 - 3.0.
+ * 
+ * The last observations in the first probe are used for validating all 
+ * parameters against SIMCA-QP. They have values of different magnitudes and 
+ * signs, so a transform or scaling that happens to match at one point is not 
+ * taken as affine. Results failing validation (i.e. for models having 
+ * transformed, lagged or qualitative variables) are always predicted by 
+ * SIMCA-QP.
+ */
+
+#define CGPS_NATIVE_STEP      1024.0     /* probe step (exact in float) */
+#define CGPS_NATIVE_VALIDATE  4          /* validation observations */
+#define CGPS_NATIVE_TOLERANCE 1.0E-4     /* relative tolerance for validation */
+#define CGPS_NATIVE_LEVELS    12         /* DModX levels for PModX calibration */
+
+/*
+ * The result types that can be computed by the native engine.
+ */
+#define CGPS_NATIVE_RESULTS ((1 << PREDICTED_TPS) | \
+                             (1 << PREDICTED_T2_RANGE_PS) | \
+                             (1 << PREDICTED_X_OBS_RES_PS) | \
+                             (1 << PREDICTED_DMOD_X_PS) | \
+                             (1 << PREDICTED_PMOD_X_PS) | \
+                             (1 << PREDICTED_CONTRIB_DMOD_X) | \
+                             (1 << PREDICTED_Y_PRED_PS))
+
+/*
+ * The result types requiring scores.
+ */
+#define CGPS_NATIVE_SCORES ((1 << PREDICTED_TPS) | \
+                            (1 << PREDICTED_T2_RANGE_PS) | \
+                            CGPS_NATIVE_RESIDUALS)
+
+/*
+ * The result types requiring residuals.
+ */
+#define CGPS_NATIVE_RESIDUALS ((1 << PREDICTED_X_OBS_RES_PS) | \
+                               (1 << PREDICTED_DMOD_X_PS) | \
+                               (1 << PREDICTED_PMOD_X_PS) | \
+                               (1 << PREDICTED_CONTRIB_DMOD_X))
+
+/*
+ * SIMCA-QP results for a batch of probe observations. All matrices have 
+ * observations as rows.
+ */
+struct cgps_native_probe
+{
+	int n;                       /* number of observations */
+	float *x;                    /* probe observations (n x K) */
+	struct cgps_matrix t;        /* scores (n x A) */
+	struct cgps_matrix t2;       /* Hotelling T2 (n x 1) */
+	struct cgps_matrix res;      /* residuals (n x K) */
+	struct cgps_matrix dmodx;    /* DModX (n x 1) */
+	struct cgps_matrix pmodx;    /* PModX (n x 1) */
+	struct cgps_matrix contrib;  /* DModX contributions (n x K) */
+	struct cgps_matrix y;        /* predicted Y (n x M) */
+};
+
+/*
+ * Compute DModX from the residuals e (n x k).
+ */
+static void cgps_native_dmodx(const float *e, int n, const float *f, int k, float *d)
+{
+	int i;
+	
+	cgps_kernel->sumsq(e, n, f, k, d);
+	for(i = 0; i < n; ++i) {
+		d[i] = d[i] > 0 ? sqrt(d[i]) : 0.0;
+	}
+}
+
+/*
+ * Logarithm of the gamma function (Lanczos approximation, x > 0).
+ */
+static double cgps_native_lgamma(double x)
+{
+	static const double c[] = {
+		76.18009172947146, -86.50532032941677, 24.01409824083091,
+		-1.231739572450155, 0.1208650973866179E-2, -0.5395239384953E-5
+	};
+	double y = x, tmp, ser = 1.000000000190015;
+	int j;
+	
+	tmp = x + 5.5;
+	tmp -= (x + 0.5) * log(tmp);
+	for(j = 0; j < 6; ++j) {
+		ser += c[j] / ++y;
+	}
+	return -tmp + log(2.5066282746310005 * ser / x);
+}
+
+/*
+ * Continued fraction for the incomplete beta function (modified Lentz).
+ */
+static double cgps_native_betacf(double a, double b, double x)
+{
+	double aa, c, d, del, h, qab, qam, qap;
+	int m, m2;
+	
+	qab = a + b;
+	qap = a + 1.0;
+	qam = a - 1.0;
+	c = 1.0;
+	d = 1.0 - qab * x / qap;
+	if(fabs(d) < 1.0E-300) {
+		d = 1.0E-300;
+	}
+	d = 1.0 / d;
+	h = d;
+	for(m = 1; m <= 300; ++m) {
+		m2 = 2 * m;
+		aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+		d = 1.0 + aa * d;
+		if(fabs(d) < 1.0E-300) {
+			d = 1.0E-300;
+		}
+		c = 1.0 + aa / c;
+		if(fabs(c) < 1.0E-300) {
+			c = 1.0E-300;
+		}
+		d = 1.0 / d;
+		h *= d * c;
+		aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+		d = 1.0 + aa * d;
+		if(fabs(d) < 1.0E-300) {
+			d = 1.0E-300;
+		}
+		c = 1.0 + aa / c;
+		if(fabs(c) < 1.0E-300) {
+			c = 1.0E-300;
+		}
+		d = 1.0 / d;
+		del = d * c;
+		h *= del;
+		if(fabs(del - 1.0) < 1.0E-12) {
+			break;
+		}
+	}
+	return h;
+}
+
+/*
+ * The regularized incomplete beta function I(x; a, b).
+ */
+static double cgps_native_betai(double a, double b, double x)
+{
+	double bt;
+	
+	if(x <= 0.0) {
+		return 0.0;
+	}
+	if(x >= 1.0) {
+		return 1.0;
+	}
+	bt = exp(cgps_native_lgamma(a + b) - cgps_native_lgamma(a) - cgps_native_lgamma(b) + 
+		 a * log(x) + b * log(1.0 - x));
+	if(x < (a + 1.0) / (a + b + 2.0)) {
+		return bt * cgps_native_betacf(a, b, x) / a;
+	} else {
+		return 1.0 - bt * cgps_native_betacf(b, a, 1.0 - x) / b;
+	}
+}
+
+/*
+ * Get the upper tail probability P(F > f) of the F distribution.
+ */
+static double cgps_native_fprob(double f, double df1, double df2)
+{
+	if(f <= 0.0) {
+		return 1.0;
+	}
+	return cgps_native_betai(0.5 * df2, 0.5 * df1, df2 / (df2 + df1 * f));
+}
+
+/*
+ * Solve the n x n linear system a * x = b by gaussian elimination with 
+ * partial pivoting. The solution is stored in b. Returns -1 if the system 
+ * is singular.
+ */
+static int cgps_native_solve(double *a, double *b, int n)
+{
+	double f, max = 0.0;
+	int i, j, k, p;
+	
+	for(i = 0; i < n; ++i) {
+		if(fabs(a[i * n + i]) > max) {
+			max = fabs(a[i * n + i]);
+		}
+	}
+	
+	for(k = 0; k < n; ++k) {
+		for(p = k, i = k + 1; i < n; ++i) {
+			if(fabs(a[i * n + k]) > fabs(a[p * n + k])) {
+				p = i;
+			}
+		}
+		if(fabs(a[p * n + k]) <= max * 1.0E-12) {
+			return -1;
+		}
+		if(p != k) {
+			for(j = 0; j < n; ++j) {
+				f = a[k * n + j]; a[k * n + j] = a[p * n + j]; a[p * n + j] = f;
+			}
+			f = b[k]; b[k] = b[p]; b[p] = f;
+		}
+		for(i = k + 1; i < n; ++i) {
+			f = a[i * n + k] / a[k * n + k];
+			for(j = k; j < n; ++j) {
+				a[i * n + j] -= f * a[k * n + j];
+			}
+			b[i] -= f * b[k];
+		}
+	}
+	for(k = n - 1; k >= 0; --k) {
+		for(j = k + 1; j < n; ++j) {
+			b[k] -= a[k * n + j] * b[j];
+		}
+		b[k] /= a[k * n + k];
+	}
+	
+	return 0;
+}
+
+/*
+ * Fit the weights g for s[i] = sum(g[j] * v[i][j]^2) by least squares, using 
+ * the first n rows of v (observations x c) and s (observations x 1). Returns 
+ * NULL if the system is singular or on memory allocation failure.
+ */
+static float * cgps_native_fit_sumsq(const struct cgps_matrix *v, const struct cgps_matrix *s, int n, int squared)
+{
+	double *a, *b, *u, y;
+	float *g = NULL;
+	int i, j, k, c = v->cols;
+	
+	a = calloc((size_t)c * c, sizeof(double));
+	b = calloc(c, sizeof(double));
+	u = calloc(c, sizeof(double));
+	if(!a || !b || !u) {
+		goto done;
+	}
+	
+	for(i = 0; i < n; ++i) {
+		y = cgps_matrix_get(s, i, 0);
+		if(squared) {
+			y *= y;
+		}
+		for(j = 0; j < c; ++j) {
+			u[j] = cgps_matrix_get(v, i, j);
+			u[j] *= u[j];
+		}
+		for(j = 0; j < c; ++j) {
+			b[j] += u[j] * y;
+			for(k = 0; k < c; ++k) {
+				a[j * c + k] += u[j] * u[k];
+			}
+		}
+	}
+	
+	if(cgps_native_solve(a, b, c) == 0) {
+		if((g = malloc(c * sizeof(float)))) {
+			for(j = 0; j < c; ++j) {
+				g[j] = b[j];
+			}
+		}
+	}
+	
+ done:
+	free(a);
+	free(b);
+	free(u);
+	return g;
+}
+
+/*
+ * Find out if observations are stored in rows (returns 1) or columns (returns
+ * 0) of a result matrix having n observations and c values (any number of 
+ * values if c is 0). Returns -1 if the matrix has unexpected size.
+ */
+static int cgps_native_layout(const struct cgps_matrix *m, int n, int c)
+{
+	if(m->rows == n && (m->cols == c || c == 0)) {
+		return 1;
+	}
+	if(m->cols == n && (m->rows == c || c == 0)) {
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Extract the SIMCA-QP result fmx having n observations and c values to dest
+ * (observations as rows). The layout of the SIMCA-QP result is stored in 
+ * obsrows. Returns -1 on failure.
+ */
+static int cgps_native_fetch(struct cgps_project *proj, SQX_FloatMatrix *fmx, int n, int c, int *obsrows, struct cgps_matrix *dest)
+{
+	struct cgps_matrix m;
+	int i, j;
+	
+	if(cgps_matrix_extract(proj, fmx, &m) < 0) {
+		SQX_ClearFloatMatrix(fmx);
+		return -1;
+	}
+	SQX_ClearFloatMatrix(fmx);
+	
+	if((*obsrows = cgps_native_layout(&m, n, c)) < 0) {
+		debug("unexpected size of probe result (%dx%d)", m.rows, m.cols);
+		cgps_matrix_free(&m);
+		return -1;
+	}
+	if(*obsrows) {
+		*dest = m;
+		return 0;
+	}
+	
+	c = m.rows;
+	if(cgps_matrix_alloc(dest, n, c) < 0) {
+		logerr("failed alloc memory");
+		cgps_matrix_free(&m);
+		return -1;
+	}
+	for(i = 0; i < n; ++i) {
+		for(j = 0; j < c; ++j) {
+			cgps_matrix_get(dest, i, j) = cgps_matrix_get(&m, j, i);
+		}
+	}
+	cgps_matrix_free(&m);
+	return 0;
+}
+
+/*
+ * Release the probe results.
+ */
+static void cgps_native_probe_free(struct cgps_native_probe *probe)
+{
+	free(probe->x);
+	cgps_matrix_free(&probe->t);
+	cgps_matrix_free(&probe->t2);
+	cgps_matrix_free(&probe->res);
+	cgps_matrix_free(&probe->dmodx);
+	cgps_matrix_free(&probe->pmodx);
+	cgps_matrix_free(&probe->contrib);
+	cgps_matrix_free(&probe->y);
+	memset(probe, 0, sizeof(struct cgps_native_probe));
+}
+
+/*
+ * Predict the probe observations using SIMCA-QP. The scores are required, the
+ * other results are left empty if not available.
+ */
+static int cgps_native_probe(struct cgps_project *proj, struct cgps_model *model, struct cgps_native *native, struct cgps_native_probe *probe)
+{
+	struct cgps_predict pred;
+	SQX_FloatMatrix fmx;
+	float *data;
+	int i, j, n = probe->n, k = native->nvars, a = native->ncomp, status = -1;
+	
+	/*
+	 * The batch is row-major.
+	 */
+	if(!(data = malloc((size_t)n * k * sizeof(float)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	for(i = 0; i < n; ++i) {
+		for(j = 0; j < k; ++j) {
+			data[i * k + j] = probe->x[(size_t)j * n + i];
+		}
+	}
+	
+	/*
+	 * The model is being loaded, so the prediction is prepared using the
+	 * model descriptor (not the model index).
+	 */
+	cgps_predict_init(proj, &pred, NULL);
+	if(cgps_predict_set_input(proj, &pred, data, n, k, k, NULL) < 0 || 
+	   cgps_predict_prepare_model(proj, model, &pred) < 0 || 
+	   cgps_predict_execute(proj, &pred) < 0) {
+		logerr("failed predict probe for model %d", model->number);
+		goto done;
+	}
+	
+	memset(&fmx, 0, sizeof(SQX_FloatMatrix));
+	if(!SQP_GetPredictedT(pred.handle, -1, NULL, &fmx) ||
+	   cgps_native_fetch(proj, &fmx, n, a, &native->tobs, &probe->t) < 0) {
+		logerr("failed get probe scores for model %d", model->number);
+		goto done;
+	}
+	
+	/*
+	 * Optional results (using same arguments as in result.c):
+	 */
+	if(SQP_GetPredictedT2Range(pred.handle, -1, 1, model->numcomp, &fmx)) {
+		cgps_native_fetch(proj, &fmx, n, 1, &native->t2obs, &probe->t2);
+	}
+	if(SQP_GetPredictedXObsRes(pred.handle, -1, model->numcomp, 1, 1, NULL, 1, &fmx)) {
+		cgps_native_fetch(proj, &fmx, n, k, &native->robs, &probe->res);
+	}
+	if(SQP_GetPredictedDModX(pred.handle, -1, NULL, 1, 0, &fmx)) {
+		cgps_native_fetch(proj, &fmx, n, 1, &native->dobs, &probe->dmodx);
+	}
+	if(SQP_GetPredictedPModX(pred.handle, -1, NULL, &fmx)) {
+		cgps_native_fetch(proj, &fmx, n, 1, &native->pobs, &probe->pmodx);
+	}
+	if(model->type == SQX_PLS || model->type == SQX_PLS_Class || model->type == SQX_PLS_DA) {
+		if(SQP_GetPredictedY(pred.handle, -1, model->numcomp, 1, 0, NULL, &fmx)) {
+			cgps_native_fetch(proj, &fmx, n, 0, &native->yobs, &probe->y);
+		}
+	}
+	
+	/*
+	 * The DModX contributions are predicted for one observation at time.
+	 */
+	if(cgps_matrix_alloc(&probe->contrib, n, k) == 0) {
+		for(i = 0; i < n; ++i) {
+			struct cgps_matrix c;
+			
+			if(!SQP_GetPredictedContributionsDModX(pred.handle, -1, i + 1, SQX_RX, model->numcomp, 1, 0, &fmx) ||
+			   cgps_native_fetch(proj, &fmx, 1, k, &native->cobs, &c) < 0) {
+				cgps_matrix_free(&probe->contrib);
+				break;
+			}
+			for(j = 0; j < k; ++j) {
+				cgps_matrix_get(&probe->contrib, i, j) = c.data[j];
+			}
+			cgps_matrix_free(&c);
+		}
+	}
+	status = 0;
+	
+ done:
+	cgps_predict_cleanup(proj, &pred);
+	free(data);
+	return status;
+}
+
+/*
+ * Release native engine parameters.
+ */
+static void cgps_native_destroy(struct cgps_native *native)
+{
+	if(!native->mapped) {
+		free(native->weights);
+		free(native->offset);
+		free(native->t2scale);
+		free(native->loadings);
+		free(native->center);
+		free(native->dmodx);
+		free(native->contrib);
+		free(native->coefs);
+		free(native->yoffset);
+	}
+	free(native);
+}
+
+/*
+ * Release native engine parameters for model.
+ */
+void cgps_native_free(struct cgps_model *model)
+{
+	if(model->native) {
+		cgps_native_destroy(model->native);
+		model->native = NULL;
+	}
+}
+
+/*
+ * Drop the residual parameters (and the results depending on them).
+ */
+static void cgps_native_drop_residuals(struct cgps_native *native)
+{
+	free(native->loadings);
+	free(native->center);
+	free(native->dmodx);
+	free(native->contrib);
+	native->loadings = NULL;
+	native->center = NULL;
+	native->dmodx = NULL;
+	native->contrib = NULL;
+	native->df2 = 0.0;
+}
+
+/*
+ * Check that value is within the tolerance (relative scale) of ref.
+ */
+static int cgps_native_within(double value, double ref, double scale, double tol)
+{
+	return fabs(value - ref) <= tol * (1.0 + fabs(scale));
+}
+
+/*
+ * Setup the score parameters (W and t0) and the T2 weights.
+ */
+static int cgps_native_fit_scores(struct cgps_project *proj, struct cgps_native *native, struct cgps_native_probe *probe)
+{
+	int i, j, k = native->nvars;
+	
+	native->weights = malloc((size_t)k * native->ncomp * sizeof(float));
+	native->offset = malloc(native->ncomp * sizeof(float));
+	if(!native->weights || !native->offset) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	for(i = 0; i < native->ncomp; ++i) {
+		double t0 = cgps_matrix_get(&probe->t, 0, i);
+		
+		native->offset[i] = t0;
+		for(j = 0; j < k; ++j) {
+			native->weights[i * k + j] = (cgps_matrix_get(&probe->t, j + 1, i) - t0) / CGPS_NATIVE_STEP;
+		}
+	}
+	
+	if(probe->t2.data) {
+		native->t2scale = cgps_native_fit_sumsq(&probe->t, &probe->t2, k + 1, 0);
+	}
+	return 0;
+}
+
+/*
+ * Setup the regression coefficients (B and y0) for predicted Y.
+ */
+static int cgps_native_fit_y(struct cgps_project *proj, struct cgps_native *native, struct cgps_native_probe *probe)
+{
+	int i, j, k = native->nvars, m = probe->y.cols;
+	
+	native->coefs = malloc((size_t)k * m * sizeof(float));
+	native->yoffset = malloc(m * sizeof(float));
+	if(!native->coefs || !native->yoffset) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	for(i = 0; i < m; ++i) {
+		double y0 = cgps_matrix_get(&probe->y, 0, i);
+		
+		native->yoffset[i] = y0;
+		for(j = 0; j < k; ++j) {
+			native->coefs[i * k + j] = (cgps_matrix_get(&probe->y, j + 1, i) - y0) / CGPS_NATIVE_STEP;
+		}
+	}
+	native->nyvars = m;
+	return 0;
+}
+
+/*
+ * Drop the regression coefficients.
+ */
+static void cgps_native_drop_y(struct cgps_native *native)
+{
+	free(native->coefs);
+	free(native->yoffset);
+	native->coefs = NULL;
+	native->yoffset = NULL;
+	native->nyvars = 0;
+}
+
+/*
+ * Setup the reconstruction parameters (Q and m) from the probe residuals. The
+ * residual steps gives I - R = W * Q, that is solved for Q by least squares.
+ */
+static int cgps_native_fit_residuals(struct cgps_project *proj, struct cgps_native *native, struct cgps_native_probe *probe)
+{
+	double *a, *b, *m;
+	int i, j, l, c, k = native->nvars, nc = native->ncomp, status = -1;
+	
+	native->loadings = malloc((size_t)nc * k * sizeof(float));
+	native->center = malloc(k * sizeof(float));
+	a = malloc((size_t)nc * nc * sizeof(double));
+	m = malloc((size_t)nc * nc * sizeof(double));
+	b = malloc(nc * sizeof(double));
+	if(!native->loadings || !native->center || !a || !m || !b) {
+		logerr("failed alloc memory");
+		goto done;
+	}
+	
+	/*
+	 * The normal matrix W' * W:
+	 */
+	for(i = 0; i < nc; ++i) {
+		for(c = 0; c < nc; ++c) {
+			double sum = 0.0;
+			for(j = 0; j < k; ++j) {
+				sum += (double)native->weights[i * k + j] * native->weights[c * k + j];
+			}
+			m[i * nc + c] = sum;
+		}
+	}
+	
+	for(l = 0; l < k; ++l) {
+		memcpy(a, m, (size_t)nc * nc * sizeof(double));
+		for(i = 0; i < nc; ++i) {
+			double sum = 0.0;
+			for(j = 0; j < k; ++j) {
+				double r = (cgps_matrix_get(&probe->res, j + 1, l) - 
+					    cgps_matrix_get(&probe->res, 0, l)) / CGPS_NATIVE_STEP;
+				sum += native->weights[i * k + j] * ((j == l ? 1.0 : 0.0) - r);
+			}
+			b[i] = sum;
+		}
+		if(cgps_native_solve(a, b, nc) < 0) {
+			debug("failed solve reconstruction loadings");
+			goto done;
+		}
+		native->center[l] = -cgps_matrix_get(&probe->res, 0, l);
+		for(i = 0; i < nc; ++i) {
+			native->loadings[l * nc + i] = b[i];
+			native->center[l] -= native->offset[i] * b[i];
+		}
+	}
+	status = 0;
+	
+ done:
+	free(a);
+	free(m);
+	free(b);
+	return status;
+}
+
+/*
+ * Setup the DModX and DModX contribution weights from the residuals e (n x K)
+ * of the probe observations (the origin and the steps).
+ */
+static void cgps_native_fit_dmodx(struct cgps_native *native, struct cgps_native_probe *probe, const struct cgps_matrix *e)
+{
+	int i, j, k = native->nvars;
+	
+	if(probe->dmodx.data) {
+		native->dmodx = cgps_native_fit_sumsq(e, &probe->dmodx, k + 1, 1);
+	}
+	if(probe->contrib.data && (native->contrib = malloc(k * sizeof(float)))) {
+		for(j = 0; j < k; ++j) {
+			double num = 0.0, den = 0.0;
+			for(i = 0; i <= k; ++i) {
+				num += cgps_matrix_get(&probe->contrib, i, j) * cgps_matrix_get(e, i, j);
+				den += cgps_matrix_get(e, i, j) * cgps_matrix_get(e, i, j);
+			}
+			native->contrib[j] = den > 0 ? num / den : 0.0;
+		}
+	}
+}
+
+/*
+ * Compute scores and residuals for the n observations x (column major).
+ */
+static int cgps_native_compute(struct cgps_native *native, const float *x, int n, struct cgps_matrix *t, struct cgps_matrix *e)
+{
+	if(cgps_matrix_alloc(t, n, native->ncomp) < 0) {
+		return -1;
+	}
+	cgps_kernel->scores(x, n, native->nvars, native->weights, native->offset, native->ncomp, t->data);
+	if(e) {
+		if(cgps_matrix_alloc(e, n, native->nvars) < 0) {
+			cgps_matrix_free(t);
+			return -1;
+		}
+		cgps_kernel->residuals(x, t->data, n, native->nvars, native->ncomp, native->loadings, native->center, e->data);
+	}
+	return 0;
+}
+
+/*
+ * Validate the native parameters against observation obs of the probe. The 
+ * parameters for any result failing validation is dropped. Returns -1 if the 
+ * scores fails validation.
+ */
+static int cgps_native_validate(struct cgps_project *proj, struct cgps_model *model, struct cgps_native *native, struct cgps_native_probe *probe, int obs)
+{
+	struct cgps_matrix t, e;
+	float *x, v;
+	double sum;
+	int j, c, k = native->nvars, status = -1;
+	
+	(void)model;
+	
+	if(!(x = malloc(k * sizeof(float)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	for(j = 0; j < k; ++j) {
+		x[j] = probe->x[(size_t)j * probe->n + obs];
+	}
+	memset(&e, 0, sizeof(struct cgps_matrix));
+	if(cgps_native_compute(native, x, 1, &t, native->loadings ? &e : NULL) < 0) {
+		logerr("failed alloc memory");
+		free(x);
+		return -1;
+	}
+	
+	for(c = 0; c < native->ncomp; ++c) {
+		sum = fabs(native->offset[c]);
+		for(j = 0; j < k; ++j) {
+			sum += fabs(x[j] * native->weights[c * k + j]);
+		}
+		if(!cgps_native_within(t.data[c], cgps_matrix_get(&probe->t, obs, c), sum, CGPS_NATIVE_TOLERANCE)) {
+			debug("native score %d of model %d is %g (expected %g)", 
+			      c + 1, model->number, t.data[c], cgps_matrix_get(&probe->t, obs, c));
+			goto done;
+		}
+	}
+	
+	if(native->t2scale) {
+		cgps_kernel->sumsq(t.data, 1, native->t2scale, native->ncomp, &v);
+		if(!cgps_native_within(v, cgps_matrix_get(&probe->t2, obs, 0), cgps_matrix_get(&probe->t2, obs, 0), 10 * CGPS_NATIVE_TOLERANCE)) {
+			debug("native T2 of model %d is %g (expected %g)", model->number, v, cgps_matrix_get(&probe->t2, obs, 0));
+			free(native->t2scale);
+			native->t2scale = NULL;
+		}
+	}
+	
+	if(native->loadings) {
+		for(j = 0; j < k; ++j) {
+			if(!cgps_native_within(e.data[j], cgps_matrix_get(&probe->res, obs, j), fabs(x[j]) + fabs(native->center[j]), CGPS_NATIVE_TOLERANCE)) {
+				debug("native residual %d of model %d is %g (expected %g)", 
+				      j + 1, model->number, e.data[j], cgps_matrix_get(&probe->res, obs, j));
+				cgps_native_drop_residuals(native);
+				break;
+			}
+		}
+	}
+	if(native->dmodx) {
+		cgps_native_dmodx(e.data, 1, native->dmodx, k, &v);
+		if(!cgps_native_within(v, cgps_matrix_get(&probe->dmodx, obs, 0), cgps_matrix_get(&probe->dmodx, obs, 0), 10 * CGPS_NATIVE_TOLERANCE)) {
+			debug("native DModX of model %d is %g (expected %g)", model->number, v, cgps_matrix_get(&probe->dmodx, obs, 0));
+			free(native->dmodx);
+			native->dmodx = NULL;
+		}
+	}
+	if(native->contrib) {
+		for(sum = 0.0, j = 0; j < k; ++j) {
+			sum += fabs(cgps_matrix_get(&probe->contrib, obs, j));
+		}
+		for(j = 0; j < k; ++j) {
+			if(!cgps_native_within(native->contrib[j] * e.data[j], cgps_matrix_get(&probe->contrib, obs, j), sum, 10 * CGPS_NATIVE_TOLERANCE)) {
+				debug("native DModX contribution %d of model %d is %g (expected %g)", 
+				      j + 1, model->number, native->contrib[j] * e.data[j], cgps_matrix_get(&probe->contrib, obs, j));
+				free(native->contrib);
+				native->contrib = NULL;
+				break;
+			}
+		}
+	}
+	if(native->coefs) {
+		float *y;
+		
+		if(!(y = malloc(native->nyvars * sizeof(float)))) {
+			logerr("failed alloc memory");
+			goto done;
+		}
+		cgps_kernel->scores(x, 1, k, native->coefs, native->yoffset, native->nyvars, y);
+		for(c = 0; c < native->nyvars; ++c) {
+			sum = fabs(native->yoffset[c]);
+			for(j = 0; j < k; ++j) {
+				sum += fabs(x[j] * native->coefs[c * k + j]);
+			}
+			if(!cgps_native_within(y[c], cgps_matrix_get(&probe->y, obs, c), sum, CGPS_NATIVE_TOLERANCE)) {
+				debug("native predicted Y %d of model %d is %g (expected %g)", 
+				      c + 1, model->number, y[c], cgps_matrix_get(&probe->y, obs, c));
+				cgps_native_drop_y(native);
+				break;
+			}
+		}
+		free(y);
+	}
+	status = 0;
+	
+ done:
+	cgps_matrix_free(&e);
+	cgps_matrix_free(&t);
+	free(x);
+	return status;
+}
+
+/*
+ * Find the degrees of freedom (df2) for PModX by golden section search on
+ * log(df2), minimizing the squared error against the probe.
+ */
+static double cgps_native_fit_pmodx(double df1, const float *d, const struct cgps_matrix *p, int n)
+{
+	const double r = 0.6180339887498949;
+	double a = 0.0, b = log(1.0E7), x1, x2, f1, f2;
+	int i, iter;
+	
+	for(iter = 0; iter < 100; ++iter) {
+		x1 = b - r * (b - a);
+		x2 = a + r * (b - a);
+		for(f1 = f2 = 0.0, i = 0; i < n; ++i) {
+			double v = cgps_native_fprob((double)d[i] * d[i], df1, exp(x1)) - cgps_matrix_get(p, i, 0);
+			double w = cgps_native_fprob((double)d[i] * d[i], df1, exp(x2)) - cgps_matrix_get(p, i, 0);
+			f1 += v * v;
+			f2 += w * w;
+		}
+		if(f1 < f2) {
+			b = x2;
+		} else {
+			a = x1;
+		}
+	}
+	return exp(0.5 * (a + b));
+}
+
+/*
+ * Calibrate PModX using observations along the residual e (K values) of the 
+ * validation observation, having DModX between 0.25 and 3.0. The DModX is 
+ * validated at the same time.
+ */
+static void cgps_native_calibrate(struct cgps_project *proj, struct cgps_model *model, struct cgps_native *native, const float *e)
+{
+	struct cgps_native_probe probe;
+	struct cgps_matrix t, r;
+	float d[CGPS_NATIVE_LEVELS], unit;
+	int i, j, n = CGPS_NATIVE_LEVELS, k = native->nvars;
+	
+	memset(&probe, 0, sizeof(struct cgps_native_probe));
+	probe.n = n;
+	if(!(probe.x = malloc((size_t)n * k * sizeof(float)))) {
+		return;
+	}
+	
+	/*
+	 * The DModX for the center plus the residual (a single observation, 
+	 * stored with stride 1 before the levels are filled in below):
+	 */
+	for(j = 0; j < k; ++j) {
+		probe.x[j] = native->center[j] + e[j];
+	}
+	if(cgps_native_compute(native, probe.x, 1, &t, &r) < 0) {
+		cgps_native_probe_free(&probe);
+		return;
+	}
+	cgps_native_dmodx(r.data, 1, native->dmodx, k, &unit);
+	cgps_matrix_free(&t);
+	cgps_matrix_free(&r);
+	if(unit <= 0) {
+		cgps_native_probe_free(&probe);
+		return;
+	}
+	
+	for(i = 0; i < n; ++i) {
+		double alpha = 0.25 * (i + 1) / unit;
+		for(j = 0; j < k; ++j) {
+			probe.x[(size_t)j * n + i] = native->center[j] + alpha * e[j];
+		}
+	}
+	if(cgps_native_compute(native, probe.x, n, &t, &r) < 0) {
+		cgps_native_probe_free(&probe);
+		return;
+	}
+	cgps_native_dmodx(r.data, n, native->dmodx, k, d);
+	cgps_matrix_free(&t);
+	cgps_matrix_free(&r);
+	
+	if(cgps_native_probe(proj, model, native, &probe) < 0 || !probe.dmodx.data || !probe.pmodx.data) {
+		cgps_native_probe_free(&probe);
+		return;
+	}
+	
+	for(i = 0; i < n; ++i) {
+		if(!cgps_native_within(d[i], cgps_matrix_get(&probe.dmodx, i, 0), cgps_matrix_get(&probe.dmodx, i, 0), 10 * CGPS_NATIVE_TOLERANCE)) {
+			debug("native DModX of model %d is %g (expected %g)", model->number, d[i], cgps_matrix_get(&probe.dmodx, i, 0));
+			free(native->dmodx);
+			native->dmodx = NULL;
+			cgps_native_probe_free(&probe);
+			return;
+		}
+	}
+	
+	native->df1 = k - native->ncomp;
+	native->df2 = cgps_native_fit_pmodx(native->df1, d, &probe.pmodx, n);
+	for(i = 0; i < n; ++i) {
+		double p = cgps_native_fprob((double)d[i] * d[i], native->df1, native->df2);
+		if(!cgps_native_within(p, cgps_matrix_get(&probe.pmodx, i, 0), 0.0, 10 * CGPS_NATIVE_TOLERANCE)) {
+			debug("native PModX of model %d is %g (expected %g)", model->number, p, cgps_matrix_get(&probe.pmodx, i, 0));
+			native->df2 = 0.0;
+			break;
+		}
+	}
+	
+	cgps_native_probe_free(&probe);
+}
+
+/*
+ * Setup the native engine parameters for model. Returns -1 if the model can't
+ * be predicted by the native engine.
+ */
+int cgps_native_load(struct cgps_project *proj, struct cgps_model *model)
+{
+	struct cgps_native *native;
+	struct cgps_native_probe probe;
+	struct cgps_matrix t, e;
+	int j, n, k;
+	
+	if(!model->fitted || model->numcomp <= 0) {
+		debug("model %d has no components", model->number);
+		return -1;
+	}
+	if(SQX_GetNumStringsInVector(&model->lagparents) > 0 ||
+	   SQX_GetNumStringsInVector(&model->qualnames) > 0 ||
+	   SQX_GetNumStringsInVector(&model->qlagnames) > 0) {
+		debug("model %d has lagged or qualitative variables", model->number);
+		return -1;
+	}
+	if((k = SQX_GetNumStringsInVector(&model->varnames)) <= 0) {
+		debug("model %d has no quantitative variables", model->number);
+		return -1;
+	}
+	
+	if(!(native = calloc(1, sizeof(struct cgps_native)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	native->nvars = k;
+	native->ncomp = model->numcomp;
+	
+	/*
+	 * The probe observations: the origin, one step along each variable and
+	 * the validation observations (mixed signs, large values, small values
+	 * and alternating signs). All values are exact in float.
+	 */
+	memset(&probe, 0, sizeof(struct cgps_native_probe));
+	probe.n = n = k + 1 + CGPS_NATIVE_VALIDATE;
+	if(!(probe.x = calloc((size_t)n * k, sizeof(float)))) {
+		logerr("failed alloc memory");
+		goto failed;
+	}
+	for(j = 0; j < k; ++j) {
+		float v = 16.0 * ((j % 13) - 6) + 8.0;
+		
+		probe.x[(size_t)j * n + j + 1] = CGPS_NATIVE_STEP;
+		probe.x[(size_t)j * n + k + 1] = v;
+		probe.x[(size_t)j * n + k + 2] = -64.0 * v;
+		probe.x[(size_t)j * n + k + 3] = v / 256.0;
+		probe.x[(size_t)j * n + k + 4] = (j % 2 ? -1.0 : 1.0) * (4096.0 + 37.0 * (j % 29));
+	}
+	if(cgps_native_probe(proj, model, native, &probe) < 0) {
+		goto failed;
+	}
+	
+	if(cgps_native_fit_scores(proj, native, &probe) < 0) {
+		goto failed;
+	}
+	if(probe.y.data) {
+		if(cgps_native_fit_y(proj, native, &probe) < 0) {
+			cgps_native_drop_y(native);
+		}
+	}
+	if(probe.res.data) {
+		if(cgps_native_fit_residuals(proj, native, &probe) < 0) {
+			cgps_native_drop_residuals(native);
+		} else if(cgps_native_compute(native, probe.x, n, &t, &e) == 0) {
+			cgps_native_fit_dmodx(native, &probe, &e);
+			cgps_matrix_free(&t);
+			cgps_matrix_free(&e);
+		}
+	}
+	
+	for(j = k + 1; j < n; ++j) {
+		if(cgps_native_validate(proj, model, native, &probe, j) < 0) {
+			goto failed;
+		}
+	}
+	
+	/*
+	 * Calibrate PModX using the residual of the first validation observation.
+	 */
+	if(native->dmodx && probe.pmodx.data) {
+		float *r;
+		
+		if((r = malloc(k * sizeof(float)))) {
+			for(j = 0; j < k; ++j) {
+				r[j] = probe.x[(size_t)j * n + k + 1];
+			}
+			if(cgps_native_compute(native, r, 1, &t, &e) == 0) {
+				cgps_native_calibrate(proj, model, native, e.data);
+				cgps_matrix_free(&t);
+				cgps_matrix_free(&e);
+			}
+			free(r);
+		}
+	}
+	
+	debug("native engine enabled for model %d (%d variables, %d components%s%s%s%s%s%s)", 
+	      model->number, k, native->ncomp, 
+	      native->t2scale ? ", T2" : "", 
+	      native->loadings ? ", residuals" : "",
+	      native->dmodx ? ", DModX" : "", 
+	      native->df2 > 0 ? ", PModX" : "", 
+	      native->contrib ? ", DModX contributions" : "",
+	      native->coefs ? ", predicted Y" : "");
+	model->native = native;
+	cgps_native_probe_free(&probe);
+	return 0;
+	
+ failed:
+	cgps_native_destroy(native);
+	cgps_native_probe_free(&probe);
+	return -1;
+}
+
+/*
+ * Check if prediction of model and the selected results can be done by the 
+ * native engine.
+ */
+int cgps_native_usable(struct cgps_project *proj, struct cgps_model *model)
+{
+	struct cgps_native *native = model->native;
+	int result = proj->opts->result;
+	
+	if((proj->opts->engine != CGPS_ENGINE_NATIVE && !proj->mapped) || !native) {
+		return 0;
+	}
+	if(result & ~CGPS_NATIVE_RESULTS) {
+		return 0;
+	}
+	if(cgps_result_isset(result, PREDICTED_T2_RANGE_PS) && !native->t2scale) {
+		return 0;
+	}
+	if(cgps_result_isset(result, PREDICTED_X_OBS_RES_PS) && !native->loadings) {
+		return 0;
+	}
+	if(cgps_result_isset(result, PREDICTED_DMOD_X_PS) && !native->dmodx) {
+		return 0;
+	}
+	if(cgps_result_isset(result, PREDICTED_PMOD_X_PS) && !(native->dmodx && native->df2 > 0)) {
+		return 0;
+	}
+	if(cgps_result_isset(result, PREDICTED_CONTRIB_DMOD_X) && !native->contrib) {
+		return 0;
+	}
+	if(cgps_result_isset(result, PREDICTED_Y_PRED_PS) && !native->coefs) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Size of the arena memory needed for predicting n observations.
+ */
+static size_t cgps_native_scratch(struct cgps_project *proj, struct cgps_native *native, int n)
+{
+	size_t size = (size_t)n * native->nvars;
+	
+	if(proj->opts->result & CGPS_NATIVE_SCORES) {
+		size += (size_t)n * native->ncomp;
+	}
+	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_PRED_PS)) {
+		size += (size_t)n * native->nyvars;
+	}
+	if(proj->opts->result & CGPS_NATIVE_RESIDUALS) {
+		size += (size_t)n * native->nvars;
+	}
+	return size * sizeof(float) + 4 * CGPS_ARENA_ALIGN;
+}
+
+/*
+ * Check if any value is missing (NaN, as stored by the table loader).
+ */
+static int cgps_native_missing(const float *x, size_t size)
+{
+	size_t i;
+	
+	for(i = 0; i < size; ++i) {
+		if(x[i] != x[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Make prediction using the native engine. The observations are taken from 
+ * the batch or loaded by the indata callback. The data is allocated from the
+ * arena of the prediction, that is pre-sized for all of it. Returns 1 if any
+ * observation has missing values, these has to be predicted by SIMCA-QP that
+ * applies its missing value handling. Returns -1 on error.
+ */
+int cgps_native_predict(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred)
+{
+	struct cgps_native *native = model->native;
+	int n;
+	
+	if(pred->batch) {
+		n = pred->rows;
+	} else {
+		pred->loaded = 1;
+		if(cgps_predict_get_raw_data(proj, model, pred) < 0) {
+			logerr("failed call cgps_predict_get_raw_data()");
+			return -1;
+		}
+		if(SQX_GetNumColumnsInFloatMatrix(pred->morawdata) != native->nvars) {
+			logerr("loaded %d variables, but model needs %d variables", 
+			       SQX_GetNumColumnsInFloatMatrix(pred->morawdata), native->nvars);
+			return -1;
+		}
+		n = SQX_GetNumRowsInFloatMatrix(pred->morawdata);
+	}
+	
+	if(cgps_arena_reserve(&pred->arena, cgps_native_scratch(proj, native, n)) < 0 || 
+	   !(pred->xdata = cgps_arena_alloc(&pred->arena, (size_t)n * native->nvars * sizeof(float)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	if(!pred->batch) {
+		if(cgps_matrix_read(proj, pred->morawdata, pred->xdata) < 0) {
+			return -1;
+		}
+	} else if(!pred->colmap && pred->stride == pred->cols) {
+		cgps_kernel->transpose(pred->batch, n, native->nvars, pred->xdata);
+	} else {
+		int i, j;
+		
+		for(i = 0; i < n; ++i) {
+			for(j = 0; j < native->nvars; ++j) {
+				pred->xdata[(size_t)j * n + i] = cgps_predict_input(pred, i, j);
+			}
+		}
+	}
+	if(cgps_native_missing(pred->xdata, (size_t)n * native->nvars)) {
+		return 1;
+	}
+	
+	if(proj->opts->result & CGPS_NATIVE_SCORES) {
+		if(!(pred->tdata = cgps_arena_alloc(&pred->arena, (size_t)n * native->ncomp * sizeof(float)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		cgps_kernel->scores(pred->xdata, n, native->nvars, native->weights, native->offset, native->ncomp, pred->tdata);
+	}
+	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_PRED_PS)) {
+		if(!(pred->ydata = cgps_arena_alloc(&pred->arena, (size_t)n * native->nyvars * sizeof(float)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		cgps_kernel->scores(pred->xdata, n, native->nvars, native->coefs, native->yoffset, native->nyvars, pred->ydata);
+	}
+	
+	if(proj->opts->result & CGPS_NATIVE_RESIDUALS) {
+		if(!(pred->edata = cgps_arena_alloc(&pred->arena, (size_t)n * native->nvars * sizeof(float)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		cgps_kernel->residuals(pred->xdata, pred->tdata, n, native->nvars, native->ncomp, 
+				      native->loadings, native->center, pred->edata);
+	}
+	
+	pred->obs = n;
+	pred->native = 1;
+	debug("predicted %d observations using native engine", n);
+	
+	return 0;
+}
+
+/*
+ * Release the native prediction data. The memory is returned to the arena by
+ * cgps_predict_release().
+ */
+void cgps_native_release(struct cgps_predict *pred)
+{
+	pred->xdata = NULL;
+	pred->tdata = NULL;
+	pred->edata = NULL;
+	pred->ydata = NULL;
+	pred->native = 0;
+}
+
+/*
+ * Copy the n x c matrix values (column major) to dest, transposed unless the
+ * observations are stored in rows (same layout as the SIMCA-QP result). The
+ * memory of dest is reused if large enough.
+ */
+static int cgps_native_output(struct cgps_project *proj, const float *values, int n, int c, int obsrows, struct cgps_matrix *dest)
+{
+	if(cgps_matrix_resize(dest, obsrows ? n : c, obsrows ? c : n) < 0) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	if(obsrows) {
+		memcpy(dest->data, values, (size_t)n * c * sizeof(float));
+	} else {
+		cgps_kernel->transpose(values, c, n, dest->data);
+	}
+	return 0;
+}
+
+/*
+ * Resize dest for a vector of n values. A vector is stored the same way in
+ * both layouts, so the values can be computed direct into dest.
+ */
+static float * cgps_native_output_resize(struct cgps_project *proj, int n, int obsrows, struct cgps_matrix *dest)
+{
+	if(cgps_matrix_resize(dest, obsrows ? n : 1, obsrows ? 1 : n) < 0) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	return dest->data;
+}
+
+/*
+ * Compute a vector with one value for each observation into dest.
+ */
+static int cgps_native_output_vector(struct cgps_project *proj, struct cgps_predict *pred, void (*func)(const float *, int, const float *, int, float *), const float *v, const float *g, int c, int obsrows, struct cgps_matrix *dest)
+{
+	float *s;
+	
+	if(!(s = cgps_native_output_resize(proj, pred->obs, obsrows, dest))) {
+		return -1;
+	}
+	func(v, pred->obs, g, c, s);
+	return 0;
+}
+
+/*
+ * Get predicted scores.
+ */
+int cgps_native_tps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest)
+{
+	struct cgps_native *native = pred->model->native;
+	
+	return cgps_native_output(proj, pred->tdata, pred->obs, native->ncomp, native->tobs, dest);
+}
+
+/*
+ * Get predicted Hotelling T2.
+ */
+int cgps_native_t2_range(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest)
+{
+	struct cgps_native *native = pred->model->native;
+	
+	return cgps_native_output_vector(proj, pred, cgps_kernel->sumsq, pred->tdata, native->t2scale, 
+					 native->ncomp, native->t2obs, dest);
+}
+
+/*
+ * Get predicted (unscaled) residuals.
+ */
+int cgps_native_x_obs_res(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest)
+{
+	struct cgps_native *native = pred->model->native;
+	
+	return cgps_native_output(proj, pred->edata, pred->obs, native->nvars, native->robs, dest);
+}
+
+/*
+ * Get predicted DModX (normalized).
+ */
+int cgps_native_dmod_x(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest)
+{
+	struct cgps_native *native = pred->model->native;
+	
+	return cgps_native_output_vector(proj, pred, cgps_native_dmodx, pred->edata, native->dmodx, 
+					 native->nvars, native->dobs, dest);
+}
+
+/*
+ * Get predicted PModX.
+ */
+int cgps_native_pmod_x(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest)
+{
+	struct cgps_native *native = pred->model->native;
+	float *d;
+	int i;
+	
+	if(!(d = cgps_native_output_resize(proj, pred->obs, native->pobs, dest))) {
+		return -1;
+	}
+	cgps_native_dmodx(pred->edata, pred->obs, native->dmodx, native->nvars, d);
+	for(i = 0; i < pred->obs; ++i) {
+		d[i] = cgps_native_fprob((double)d[i] * d[i], native->df1, native->df2);
+	}
+	return 0;
+}
+
+/*
+ * Get the DModX contributions for observation obs (1 .. pred->obs).
+ */
+int cgps_native_contrib_dmod_x(struct cgps_project *proj, struct cgps_predict *pred, int obs, struct cgps_matrix *dest)
+{
+	struct cgps_native *native = pred->model->native;
+	float *c;
+	int j;
+	
+	if(!(c = cgps_native_output_resize(proj, native->nvars, !native->cobs, dest))) {
+		return -1;
+	}
+	for(j = 0; j < native->nvars; ++j) {
+		c[j] = native->contrib[j] * pred->edata[(size_t)j * pred->obs + obs - 1];
+	}
+	return 0;
+}
+
+/*
+ * Get predicted Y (unscaled).
+ */
+int cgps_native_y_pred(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest)
+{
+	struct cgps_native *native = pred->model->native;
+	
+	return cgps_native_output(proj, pred->ydata, pred->obs, native->nyvars, native->yobs, dest);
+}
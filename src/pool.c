@@ -0,0 +1,192 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Pool of project handles loaded from the same project file. Each handle
+ * is used by one thread at time, so predictions against different handles
+ * can run in parallel. The busy flags are updated using atomic operations, 
+ * no lock is taken on checkout or checkin.
+ */
+
+/*
+ * Load size number of handles for the project in path. If size is <= 0, then
+ * the number of handles is taken from the worker threads option.
+ */
+int cgps_project_pool_load(struct cgps_project_pool *pool, const char *path, struct cgps_options *opts, int size)
+{
+	struct cgps_project *proj;
+	int i;
+	
+	memset(pool, 0, sizeof(struct cgps_project_pool));
+	
+	if(!(pool->proj = calloc(size > 0 ? size : 1, sizeof(struct cgps_project)))) {
+		return -1;
+	}
+	
+	/*
+	 * The first project sets default options (like the logger) used below.
+	 */
+	if(cgps_project_load(&pool->proj[0], path, opts) < 0) {
+		free(pool->proj);
+		pool->proj = NULL;
+		return -1;
+	}
+	proj = &pool->proj[0];
+	pool->size = 1;
+	
+	if(size <= 0) {
+		size = cgps_worker_threads(proj);
+		if(size > 1) {
+			if(!(proj = realloc(pool->proj, size * sizeof(struct cgps_project)))) {
+				proj = &pool->proj[0];
+				logerr("failed alloc memory");
+				cgps_project_pool_close(pool);
+				return -1;
+			}
+			pool->proj = proj;
+		}
+	}
+	
+	if(!(pool->busy = calloc(size, sizeof(int)))) {
+		logerr("failed alloc memory");
+		cgps_project_pool_close(pool);
+		return -1;
+	}
+	
+	for(i = 1; i < size; ++i) {
+		if(cgps_project_load(&pool->proj[i], path, opts) < 0) {
+			logerr("failed load project handle %d of %d in pool", i + 1, size);
+			cgps_project_pool_close(pool);
+			return -1;
+		}
+		pool->size++;
+	}
+	
+	debug("loaded pool of %d project handles", pool->size);
+	return 0;
+}
+
+/*
+ * Checkout a project handle from the pool. Returns NULL if all handles are
+ * in use, unless wait is non-zero. In that case, the calling thread yields 
+ * until a handle is checked in.
+ */
+struct cgps_project * cgps_project_pool_checkout(struct cgps_project_pool *pool, int wait)
+{
+	int i, start;
+	
+	do {
+		start = pool->next;
+		for(i = 0; i < pool->size; ++i) {
+			int slot = (start + i) % pool->size;
+			if(__sync_bool_compare_and_swap(&pool->busy[slot], 0, 1)) {
+				pool->next = (slot + 1) % pool->size;   /* hint only */
+				return &pool->proj[slot];
+			}
+		}
+		if(wait) {
+#ifdef HAVE_SCHED_YIELD
+			sched_yield();
+#endif
+		}
+	} while(wait);
+	
+	return NULL;
+}
+
+/*
+ * Return a project handle to the pool.
+ */
+void cgps_project_pool_checkin(struct cgps_project_pool *pool, struct cgps_project *proj)
+{
+	int slot = proj - pool->proj;
+	
+	if(slot < 0 || slot >= pool->size) {
+		logerr("project handle is not a member of the pool");
+		return;
+	}
+	__sync_lock_release(&pool->busy[slot]);
+}
+
+/*
+ * Restore the pool in a child process. Handles checked out by threads in the
+ * parent process are returned, as those threads don't exist in the child.
+ */
+int cgps_project_pool_postfork(struct cgps_project_pool *pool)
+{
+	int i, status = 0;
+	
+	for(i = 0; i < pool->size; ++i) {
+		pool->busy[i] = 0;
+		if(cgps_project_postfork(&pool->proj[i]) < 0) {
+			status = -1;
+		}
+	}
+	pool->next = 0;
+	__sync_synchronize();
+	
+	return status;
+}
+
+/*
+ * Close all project handles in the pool.
+ */
+void cgps_project_pool_close(struct cgps_project_pool *pool)
+{
+	int i;
+	
+	if(pool->proj) {
+		for(i = 0; i < pool->size; ++i) {
+			cgps_project_close(&pool->proj[i]);
+		}
+		free(pool->proj);
+		pool->proj = NULL;
+	}
+	if(pool->busy) {
+		free(pool->busy);
+		pool->busy = NULL;
+	}
+	pool->size = 0;
+}
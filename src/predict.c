@@ -29,12 +29,19 @@
 # include "config.h"
 #endif
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <stdio.h>
 #ifdef HAVE_STDLIB_H
 # include <stdlib.h>
 #endif
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "chemgps.h"
 #include "simcaqp.h"
@@ -44,7 +51,7 @@
  */
 void cgps_predict_init(struct cgps_project *proj, struct cgps_predict *pred, void *data)
 {
-	if(proj->handle) {
+	if(cgps_project_isopen(proj)) {
 		debug("initilizing before predict");
 	} else {
 		logwarn("no valid project handle");
@@ -54,49 +61,137 @@ void cgps_predict_init(struct cgps_project *proj, struct cgps_predict *pred, voi
 }
 
 /*
- * Make prediction.
+ * Release the result of last prediction and the data loaded for it. The 
+ * data containers are kept for next prediction.
  */
-int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred)
+static void cgps_predict_release(struct cgps_project *proj, struct cgps_predict *pred)
 {
-	int fitted;
-	int model;
+	if(pred->handle) {
+		if(!SQP_ReleaseHandle(pred->handle)) {
+			logerr("failed release handle for predict");
+		}
+		pred->handle = 0;
+	}
 	
-	if(!SQX_GetModelNumber(proj->handle, index, &model)) {
-		logerr("failed get model number for model index %d", index);
-		return -1;
-	} else {
-		debug("got model number %d for model index %d", model, index);
+	if(pred->loaded) {
+		if(pred->morawdata) {
+			SQX_ClearFloatMatrix(pred->morawdata);
+		}
+		if(pred->molagdata) {
+			SQX_ClearFloatMatrix(pred->molagdata);
+		}
+		if(pred->mqrawdata) {
+			SQX_ClearStringMatrix(pred->mqrawdata);
+		}
+		if(pred->mqlagdata) {
+			SQX_ClearStringMatrix(pred->mqlagdata);
+		}
+		pred->loaded = 0;
 	}
+	cgps_native_release(pred);
+	cgps_arena_reset(&pred->arena);
+	pred->obs = 0;
+}
+
+/*
+ * Release the data containers of the prepared model.
+ */
+static void cgps_predict_unprepare(struct cgps_project *proj, struct cgps_predict *pred)
+{
+	cgps_predict_release(proj, pred);
 	
-	if(!SQX_IsModelFitted(proj->handle, model, &fitted)) {
-		fitted = 0;
-		logerr("failed check if model is fitted");
-	} else {
-		debug("model number %d is fitted", model);
+	pred->porawdata = NULL;
+	pred->pqrawdata = NULL;
+	pred->morawdata = NULL;
+	pred->molagdata = NULL;
+	pred->mqrawdata = NULL;
+	pred->mqlagdata = NULL;
+	cgps_arena_clear(&pred->arena);
+	cgps_predict_input_free(pred);
+	
+	pred->model = NULL;
+	if(pred->proj) {
+		if(pred->ref) {
+			cgps_project_release(pred->proj);
+			pred->ref = 0;
+		}
+		pred->proj = NULL;
 	}
-	if(!fitted) {
-		logerr("model number %d is not fitted (skipped model)", model);
-		return -1;
+}
+
+/*
+ * Allocate zero filled memory for the prepared model.
+ */
+static void * cgps_predict_alloc(struct cgps_predict *pred, size_t size)
+{
+	void *ptr;
+	
+	if((ptr = cgps_arena_alloc(&pred->arena, size))) {
+		memset(ptr, 0, size);
 	}
+	return ptr;
+}
 
-	if(cgps_predict_get_raw_data(proj, model, pred, &pred->varnames) < 0) {
-		logerr("failed call cgps_predict_get_raw_data()");
+/*
+ * Prepare for prediction using model at index. Resolves the model and allocates
+ * the data containers sent to SIMCA-QP. Returns model number or -1 on error.
+ */
+int cgps_predict_prepare(struct cgps_project *proj, int index, struct cgps_predict *pred)
+{
+	struct cgps_model *model;
+	
+	if(pred->model) {
+		if(pred->proj == proj && pred->model->index == index) {
+			debug("prediction is already prepared for model index %d", index);
+			return pred->model->number;
+		}
+		cgps_predict_unprepare(proj, pred);
+	}
+	
+	if(!(model = cgps_project_model_index(proj, index))) {
+		logerr("failed get model for model index %d", index);
 		return -1;
 	}
+	return cgps_predict_prepare_model(proj, model, pred);
+}
 
-	if(cgps_predict_get_lag_parents(proj, model, pred, &pred->lagparents) < 0) {
-		logerr("failed call cgps_predict_get_lag_parents()");
+/*
+ * Prepare for prediction using the model descriptor. This is used direct while
+ * the model is being loaded. Returns model number or -1 on error.
+ */
+int cgps_predict_prepare_model(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred)
+{
+	if(!model->fitted) {
+		logerr("model number %d is not fitted (skipped model)", model->number);
 		return -1;
 	}
 	
-	if(cgps_predict_get_qual_data(proj, model, pred, &pred->qualnames) < 0) {
-		logerr("failed call cgps_predict_get_qual_data()");
-		return -1;
+	if(SQX_GetNumStringsInVector(&model->varnames) > 0) {
+		if(!(pred->morawdata = cgps_predict_alloc(pred, sizeof(SQX_FloatMatrix)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
 	}
-	
-	if(cgps_predict_get_qual_data_lagged(proj, model, pred, &pred->qlagnames) < 0) {
-		logerr("failed call cgps_predict_get_qual_data_lagged()");
-		return -1;
+	if(SQX_GetNumStringsInVector(&model->lagparents) > 0) {
+		if(!(pred->molagdata = cgps_predict_alloc(pred, sizeof(SQX_FloatMatrix)))) {
+			logerr("failed alloc memory");
+			cgps_predict_unprepare(proj, pred);
+			return -1;
+		}
+	}
+	if(SQX_GetNumStringsInVector(&model->qualnames) > 0) {
+		if(!(pred->mqrawdata = cgps_predict_alloc(pred, sizeof(SQX_StringMatrix)))) {
+			logerr("failed alloc memory");
+			cgps_predict_unprepare(proj, pred);
+			return -1;
+		}
+	}
+	if(SQX_GetNumStringsInVector(&model->qlagnames) > 0) {
+		if(!(pred->mqlagdata = cgps_predict_alloc(pred, sizeof(SQX_StringMatrix)))) {
+			logerr("failed alloc memory");
+			cgps_predict_unprepare(proj, pred);
+			return -1;
+		}
 	}
 
 	/*
@@ -104,9 +199,10 @@ int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred
 	 * is sent to SIMCA-QP.
 	 */
 	if(pred->morawdata || pred->molagdata) {
-		pred->porawdata = malloc(sizeof(SQP_ObservationRawData));
+		pred->porawdata = cgps_predict_alloc(pred, sizeof(SQP_ObservationRawData));
 		if(!pred->porawdata) {
 			logerr("failed alloc memory");
+			cgps_predict_unprepare(proj, pred);
 			return -1;
 		}
 		pred->porawdata->pObsRawData  = pred->morawdata;
@@ -120,9 +216,10 @@ int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred
 	 * is sent to SIMCA-QP.
 	 */
 	if(pred->mqrawdata || pred->mqlagdata) {
-		pred->pqrawdata = malloc(sizeof(SQP_QualitativeRawData));
+		pred->pqrawdata = cgps_predict_alloc(pred, sizeof(SQP_QualitativeRawData));
 		if(!pred->pqrawdata) {
 			logerr("failed alloc memory");
+			cgps_predict_unprepare(proj, pred);
 			return -1;
 		}
 		pred->pqrawdata->pQualRawData  = pred->mqrawdata;
@@ -130,12 +227,123 @@ int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred
 		pred->pqrawdata->pQualLagData  = pred->mqlagdata;
 		pred->pqrawdata->pQualLagNames = NULL;
 	}
+	
+	/*
+	 * The containers are kept in the arena until the model is unprepared,
+	 * the data of each prediction is released by cgps_predict_release().
+	 */
+	cgps_arena_keep(&pred->arena);
+	
+	/*
+	 * A reloadable project is kept open while prepared for, so the model is
+	 * valid until unprepared even if the project is replaced.
+	 */
+	if(__sync_fetch_and_add(&proj->refs, 0) > 0) {
+		__sync_fetch_and_add(&proj->refs, 1);
+		pred->ref = 1;
+	}
+	pred->proj = proj;
+	pred->model = model;
+	debug("prepared prediction for model number %d", model->number);
+	
+	return model->number;
+}
+
+/*
+ * Make prediction using the prepared model. The data for prediction is loaded 
+ * by the indata callback (called with pred->data) or taken from the batch. 
+ * Returns model number or -1 on error.
+ */
+int cgps_predict_execute(struct cgps_project *proj, struct cgps_predict *pred)
+{
+	struct cgps_model *model = pred->model;
+	
+	if(!model) {
+		logerr("prediction is not prepared");
+		return -1;
+	}
+	if(pred->proj != proj) {
+		logerr("prediction is prepared for another project");
+		return -1;
+	}
+	if(proj->pid && proj->pid != getpid()) {
+		logerr("project used in forked process %d without calling cgps_project_postfork()", (int)getpid());
+		return -1;
+	}
+	cgps_predict_release(proj, pred);
+	
+	if(pred->batch) {
+		if(cgps_predict_input_map(proj, model, pred) < 0) {
+			logerr("failed map batch columns for model %d", model->number);
+			return -1;
+		}
+	}
+	
+	/*
+	 * Use the native engine if all selected results are supported.
+	 */
+	if(cgps_native_usable(proj, model)) {
+		switch(cgps_native_predict(proj, model, pred)) {
+		case 0:
+			return model->number;
+		case 1:
+			/*
+			 * Missing values are handled by SIMCA-QP. The loaded raw
+			 * data (if any) is reused.
+			 */
+			cgps_native_release(pred);
+			if(!proj->handle) {
+				logerr("observations with missing values can't be predicted from a model file (model %d)", model->number);
+				return -1;
+			}
+			debug("input has missing values, predicting model %d using SIMCA-QP", model->number);
+			break;
+		default:
+			logerr("failed predict using native engine");
+			cgps_native_release(pred);
+			return -1;
+		}
+	}
+	if(!proj->handle) {
+		logerr("model %d or the selected results can't be predicted from a model file", model->number);
+		return -1;
+	}
+	
+	if(!pred->loaded) {
+		pred->loaded = 1;
+		if(cgps_predict_get_raw_data(proj, model, pred) < 0) {
+			logerr("failed call cgps_predict_get_raw_data()");
+			return -1;
+		}
+	}
+
+	if(pred->morawdata) {
+		pred->obs = SQX_GetNumRowsInFloatMatrix(pred->morawdata);
+	} else {
+		pred->obs = DEFAULT_NUMBER_OBSERVATIONS;
+	}
+	debug("predicting %d observations", pred->obs);
+
+	if(cgps_predict_get_lag_parents(proj, model, pred) < 0) {
+		logerr("failed call cgps_predict_get_lag_parents()");
+		return -1;
+	}
+	
+	if(cgps_predict_get_qual_data(proj, model, pred) < 0) {
+		logerr("failed call cgps_predict_get_qual_data()");
+		return -1;
+	}
+	
+	if(cgps_predict_get_qual_data_lagged(proj, model, pred) < 0) {
+		logerr("failed call cgps_predict_get_qual_data_lagged()");
+		return -1;
+	}
 
 	/*
 	 * Make the prediction.
 	 */
 	if(!SQP_Predict(proj->handle, 
-			model, 
+			model->number, 
 			pred->porawdata, 
 			pred->pqrawdata, 
 			0, 
@@ -144,89 +352,263 @@ int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred
 		return -1;
 	}
 	
+	return model->number;
+}
+
+/*
+ * Make prediction.
+ */
+int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred)
+{
+	if(cgps_predict_prepare(proj, index, pred) < 0) {
+		return -1;
+	}
+	return cgps_predict_execute(proj, pred);
+}
+
+/*
+ * Use the caller supplied matrix data (row-major) as quantitative input for 
+ * the following predictions instead of calling the indata callback. The data
+ * is read direct from the caller (no intermediate copy) and columns are picked
+ * by name if colnames is non-NULL. Passing NULL data restores the indata 
+ * callback. Returns -1 on error.
+ */
+int cgps_predict_set_input(struct cgps_project *proj, struct cgps_predict *pred, const float *data, int rows, int cols, int stride, const char **colnames)
+{
+	cgps_predict_input_free(pred);
+	
+	pred->batch    = NULL;
+	pred->rows     = 0;
+	pred->cols     = 0;
+	pred->stride   = 0;
+	pred->colnames = NULL;
+	
+	if(!data) {
+		return 0;
+	}
+	if(stride == 0) {
+		stride = cols;
+	}
+	if(rows <= 0 || cols <= 0 || stride < cols) {
+		logerr("invalid batch matrix (%d rows, %d columns, stride %d)", rows, cols, stride);
+		return -1;
+	}
+	
+	pred->batch    = data;
+	pred->rows     = rows;
+	pred->cols     = cols;
+	pred->stride   = stride;
+	pred->colnames = colnames;
+	return 0;
+}
+
+/*
+ * Make prediction of multiple observations at once. The quantitative data is 
+ * taken from the rows x cols matrix data (row-major) instead of calling the 
+ * indata callback. The columns in data must be in the same order as the 
+ * quantitative variable names of the model.
+ */
+int cgps_predict_batch(struct cgps_project *proj, int index, struct cgps_predict *pred, const float *data, int rows, int cols)
+{
+	int model;
+	
+	if(!data) {
+		logerr("invalid batch matrix (%d rows, %d columns)", rows, cols);
+		return -1;
+	}
+	if(cgps_predict_set_input(proj, pred, data, rows, cols, cols, NULL) < 0) {
+		return -1;
+	}
+	
+	model = cgps_predict(proj, index, pred);
+	
+	cgps_predict_set_input(proj, pred, NULL, 0, 0, 0, NULL);
 	return model;
 }
 
 /*
- * Cleanup after an prediction.
+ * Cleanup after an prediction. This releases the prepared model and the 
+ * caller supplied input too.
  */
 void cgps_predict_cleanup(struct cgps_project *proj, struct cgps_predict *pred)
 {
-	if(proj->handle) {
+	if(cgps_project_isopen(proj)) {
 		debug("cleaning up after prediction");
 	} else {
 		logwarn("no valid project handle");
 	}
 	
-	/*
-	 * Cleanup string vectors.
-	 */
-	if(SQX_GetNumStringsInVector(&pred->varnames)) {
-		SQX_ClearStringVector(&pred->varnames);
-	}
-	if(SQX_GetNumStringsInVector(&pred->lagparents)) {
-		SQX_ClearStringVector(&pred->lagparents);
+	cgps_predict_unprepare(proj, pred);
+	cgps_predict_set_input(proj, pred, NULL, 0, 0, 0, NULL);
+	cgps_arena_free(&pred->arena);
+}
+
+/*
+ * State for predicting one model in cgps_predict_all_models().
+ */
+struct cgps_predict_job
+{
+	struct cgps_project_pool *pool;  /* handles to checkout (NULL if single) */
+	void *data;                 /* callback data for indata() */
+	char *buff;                 /* result output */
+	size_t size;                /* size of result output */
+	int model;                  /* model number or -1 */
+	int status;                 /* -1 if prediction failed */
+	int partial;                /* some results failed (output is kept) */
+};
+
+/*
+ * Predict the model at index and write its result to the memory buffer of the 
+ * job.
+ */
+static int cgps_predict_model_output(struct cgps_project *proj, struct cgps_predict_job *pjob, int index)
+{
+	struct cgps_model *model;
+	struct cgps_predict pred;
+	struct cgps_result res;
+	FILE *out;
+	int status = 0;
+	
+	if(!(model = cgps_project_model_index(proj, index))) {
+		return -1;
 	}
-	if(SQX_GetNumStringsInVector(&pred->qualnames)) {
-		SQX_ClearStringVector(&pred->qualnames);
+	if(!model->fitted) {
+		debug("model index %d is not fitted (skipped model)", index);
+		return 0;
 	}
-	if(SQX_GetNumStringsInVector(&pred->qlagnames)) {
-		SQX_ClearStringVector(&pred->qlagnames);
+	
+	if(!(out = open_memstream(&pjob->buff, &pjob->size))) {
+		logerr("failed open buffer writer stream");
+		return -1;
 	}
 	
-	/*
-	 * Cleanup observation data.
-	 */
-	if(pred->porawdata) {
-		if(pred->porawdata->pObsRawData) {
-			SQX_ClearFloatMatrix(pred->porawdata->pObsRawData);
-			pred->porawdata->pObsRawData = NULL;
+	cgps_predict_init(proj, &pred, pjob->data);
+	if((pjob->model = cgps_predict(proj, index, &pred)) != -1) {
+		if(cgps_result_init(proj, &res) == 0) {
+			if(cgps_result(proj, pjob->model, &pred, &res, out) != 0) {
+				/*
+				 * The prediction succeeded, so the results written
+				 * before and after the failing one are still output.
+				 */
+				logerr("failed get result for model %d", pjob->model);
+				pjob->partial = 1;
+			}
+			cgps_result_cleanup(proj, &res);
+		} else {
+			logerr("failed initilize result for model %d", pjob->model);
+			status = -1;
 		}
+	} else {
+		logerr("failed predict model index %d", index);
+		status = -1;
+	}
+	cgps_predict_cleanup(proj, &pred);
 	
-		if(pred->porawdata->pObsLagData) {
-			SQX_ClearFloatMatrix(pred->porawdata->pObsLagData);
-			pred->porawdata->pObsLagData = NULL;
-		}
-		free(pred->porawdata);
-		pred->porawdata = NULL;
+	if(fclose(out) != 0) {
+		logerr("failed close buffer writer stream");
+		status = -1;
 	}
-	if(pred->morawdata) {
-		free(pred->morawdata);
-		pred->morawdata = NULL;
+	return status;
+}
+
+/*
+ * Predict the model at index job + 1. The prediction is made using a handle
+ * checked out from the pool (if any), as a project handle must only be used
+ * by one thread at time.
+ */
+static int cgps_predict_model_job(struct cgps_project *proj, void *arg, int job)
+{
+	struct cgps_predict_job *pjob = (struct cgps_predict_job *)arg + job;
+	
+	pjob->model = -1;
+	if(pjob->pool) {
+		proj = cgps_project_pool_checkout(pjob->pool, 1);
+		pjob->status = cgps_predict_model_output(proj, pjob, job + 1);
+		cgps_project_pool_checkin(pjob->pool, proj);
+	} else {
+		pjob->status = cgps_predict_model_output(proj, pjob, job + 1);
+	}
+	return pjob->status;
+}
+
+/*
+ * Predict all models using threads number of threads and write the result to
+ * out in model order. The result of models that failed is left out, while the
+ * results of a model where only some of the results failed are written. 
+ * Returns the number of predicted models or -1 if any model failed.
+ */
+static int cgps_predict_models(struct cgps_project *proj, struct cgps_project_pool *pool, int threads, void *data, FILE *out)
+{
+	struct cgps_predict_job *jobs;
+	int i, failed = 0, predicted = 0;
+	
+	if(proj->models <= 0) {
+		logwarn("project has no models");
+		return 0;
+	}
+	if(!(jobs = calloc(proj->models, sizeof(struct cgps_predict_job)))) {
+		logerr("failed alloc memory");
+		return -1;
 	}
-	if(pred->molagdata) {
-		free(pred->molagdata);
-		pred->molagdata = NULL;
+	for(i = 0; i < proj->models; ++i) {
+		jobs[i].pool = pool;
+		jobs[i].data = data;
 	}
 	
-	/*
-	 * Cleanup qualitative data.
-	 */
-	if(pred->pqrawdata) {
-		if(pred->pqrawdata->pQualRawData) {
-			SQX_ClearStringMatrix(pred->pqrawdata->pQualRawData);
-			pred->pqrawdata->pQualRawData = NULL;
+	if(cgps_worker_run(proj, threads, proj->models, cgps_predict_model_job, jobs) < 0) {
+		free(jobs);
+		return -1;
+	}
+	
+	for(i = 0; i < proj->models; ++i) {
+		if(jobs[i].status < 0) {
+			logerr("failed predict model index %d (result not written)", i + 1);
+			++failed;
+		} else if(jobs[i].model != -1 && jobs[i].buff) {
+			if(fwrite(jobs[i].buff, 1, jobs[i].size, out) != jobs[i].size) {
+				logerr("failed write result for model %d", jobs[i].model);
+				++failed;
+			} else if(jobs[i].partial) {
+				logerr("incomplete result for model %d (partial result written)", jobs[i].model);
+				++failed;
+			} else {
+				++predicted;
+			}
 		}
-		if(pred->pqrawdata->pQualLagData) {
-			SQX_ClearStringMatrix(pred->pqrawdata->pQualLagData);
-			pred->pqrawdata->pQualLagData = NULL;
+		if(jobs[i].buff) {
+			free(jobs[i].buff);
 		}
-		free(pred->pqrawdata);
-		pred->pqrawdata = NULL;
-	}
-	if(pred->mqrawdata) {
-		free(pred->mqrawdata);
-		pred->mqrawdata = NULL;
 	}
-	if(pred->mqlagdata) {
-		free(pred->mqlagdata);
-		pred->mqlagdata = NULL;
+	free(jobs);
+	
+	if(failed != 0) {
+		logerr("failed predict %d of %d models", failed, proj->models);
+		return -1;
 	}
+	return predicted;
+}
 
-	if(pred->handle) {
-		if(!SQP_ReleaseHandle(pred->handle)) {
-			logerr("failed release handle for predict");
-		}
-		pred->handle = 0;
+/*
+ * Make prediction against all models in the project. The models are predicted
+ * one after another, as the project handle can only be used by one thread at
+ * time (see cgps_predict_all_models_pool()). The result is written to out in 
+ * model order. Returns the number of predicted models or -1 on error.
+ */
+int cgps_predict_all_models(struct cgps_project *proj, void *data, FILE *out)
+{
+	return cgps_predict_models(proj, NULL, 1, data, out);
+}
+
+/*
+ * Make prediction against all models in the project loaded in pool. The
+ * models are predicted in parallel by up to one thread for each handle in the
+ * pool and the result is written to out in model order. Returns the number of
+ * predicted models or -1 on error.
+ */
+int cgps_predict_all_models_pool(struct cgps_project_pool *pool, void *data, FILE *out)
+{
+	if(pool->size <= 0) {
+		return -1;
 	}
+	return cgps_predict_models(&pool->proj[0], pool, pool->size, data, out);
 }
@@ -35,39 +35,232 @@
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
 
 #include "chemgps.h"
 #include "simcaqp.h"
 
 /*
- * Loads the project in path.
+ * Collect the prediction metadata for the model. The metadata is constant 
+ * once the model is loaded, so its fetched only once.
  */
-int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_options *opts)
+static int cgps_project_load_model(struct cgps_project *proj, struct cgps_model *model)
 {
-#if ! defined(__linux__)
-	char *version;               /* Simca-Q dll-version */
-#endif
-	int i;
+	if(!SQX_IsModelFitted(proj->handle, model->number, &model->fitted)) {
+		model->fitted = 0;
+		logerr("failed check if model is fitted");
+	}
+	if(!model->fitted) {
+		debug("model number %d is not fitted", model->number);
+		return 0;
+	} else {
+		debug("model number %d is fitted", model->number);
+	}
 
-	memset(proj, 0, sizeof(struct cgps_project));	
-	proj->opts = opts;
+	if(!SQX_GetModelNumberOfComponents(proj->handle, model->number, &model->numcomp)) {
+		logerr("failed get number of components for model %d (%s)", model->number, cgps_simcaq_error());
+		return -1;
+	} else {
+		debug("number of components for model %d is %d", model->number, model->numcomp);
+	}
 	
-	/*
-	 * Set default options:
-	 */
-	if(!opts->prog) {
-		opts->prog = PACKAGE_NAME;
-	}	
-	if(!opts->logger) {
-		opts->logger = cgps_stderr_logger;
+	if(!SQX_GetModelType(proj->handle, model->number, &model->type)) {
+		logerr("failed get model type for model %d (%s)", model->number, cgps_simcaq_error());
+		return -1;
+	} else {
+		if(model->type == SQX_UnDefined) {
+			debug("the model type can not be determined");
+		} else {
+#ifndef NDEBUG
+			const char *types[] = {
+				"undefined", "PCA_X", "PCA_Y", "PCA_All", 
+				"PCA_Class", "PSL_Class", "PLS", "PLS_DA"
+			};
+			debug("model %d is a %s model", model->number, types[model->type]);
+#endif /* NDEBUG */
+		}
 	}
-	if(!opts->format) {
-		opts->format = CGPS_OUTPUT_FORMAT_DEFAULT;
+	
+	if(!SQP_GetQuantitativeNamesForPredict(proj->handle, model->number, 0, &model->varnames)) {
+		logerr("failed get quantitative variable names (%s)", cgps_simcaq_error());
+		return -1;
 	}
-	if(!opts->indata) {
-		logerr("data loader function is not set in library options");
+	if(!SQP_GetLagParentNamesForPredict(proj->handle, model->number, 0, &model->lagparents)) {
+		logerr("failed get names of lagged variables (%s)", cgps_simcaq_error());
 		return -1;
 	}
+	if(!SQP_GetQualitativeNamesForPredict(proj->handle, model->number, &model->qualnames)) {
+		logerr("failed get names of the qualitative variables (%s)", cgps_simcaq_error());
+		return -1;
+	}
+	if(!SQP_GetLagParentNamesForPredict(proj->handle, model->number, 1, &model->qlagnames)) {
+		logerr("failed get names of lagged qualitative variables (%s)", cgps_simcaq_error());
+		return -1;
+	}
+	debug("successful got variable names for model %d", model->number);
+	
+	return 0;
+}
+
+/*
+ * Release the string vectors of model.
+ */
+static void cgps_project_free_model(struct cgps_model *model)
+{
+	cgps_native_free(model);
+	cgps_result_plan_free(model);
+	if(SQX_GetNumStringsInVector(&model->varnames)) {
+		SQX_ClearStringVector(&model->varnames);
+	}
+	if(SQX_GetNumStringsInVector(&model->lagparents)) {
+		SQX_ClearStringVector(&model->lagparents);
+	}
+	if(SQX_GetNumStringsInVector(&model->qualnames)) {
+		SQX_ClearStringVector(&model->qualnames);
+	}
+	if(SQX_GetNumStringsInVector(&model->qlagnames)) {
+		SQX_ClearStringVector(&model->qlagnames);
+	}
+}
+
+/*
+ * Check project flags that applies to all models.
+ */
+static int cgps_project_load_flags(struct cgps_project *proj)
+{
+	proj->isreduced = 0;
+	proj->isdatainc = 1;
+	proj->isresuinc = 1;
+	
+	/* 
+	 * Check if the project is a Reduced SIMCA-P Project (.rusp) 
+	 */
+	if(!SQX_GetIsReducedUSP(proj->handle, &proj->isreduced)) {
+		logerr("failed check if project is a reduced Simca-Q project (*.rusp) (%s)",
+		       cgps_simcaq_error());
+		return -1;
+	}
+	if(proj->isreduced) {
+		debug("project is a reduced Simca-Q project (*.rusp)");
+		
+		/* 
+		 * Check if the primary data set has been excluded from the project.
+		 */
+		if(!SQX_GetIsPrimaryDataSetIncluded(proj->handle, &proj->isdatainc)) {
+			logerr("failed check if primary data set has been excluded from the project (%s)",
+			       cgps_simcaq_error());
+			return -1;
+		} else if(!proj->isdatainc) {
+			debug("primary data set has been excluded from the project");
+		}
+		
+		/* 
+		 * Check if the model residuals has been excluded from the project.
+		 */
+		if(!SQX_GetIsModelResidualsIncluded(proj->handle, &proj->isresuinc)) {
+			logerr("failed check if the model residuals has been excluded from the project (%s)",
+			       cgps_simcaq_error());
+			return -1;
+		} else if(!proj->isresuinc) {
+			debug("model residuals has been excluded from the project");
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * Load the metadata and native engine parameters of model unless already 
+ * loaded. The first thread loads the model while other threads using the 
+ * same model waits for it to finish. A model that failed to load is not 
+ * retried. Returns -1 on failure.
+ */
+static int cgps_project_model_ensure(struct cgps_project *proj, struct cgps_model *model)
+{
+	int status;
+	
+	for(;;) {
+		switch(__sync_fetch_and_add(&model->state, 0)) {
+		case CGPS_MODEL_LOADED:
+			return 0;
+		case CGPS_MODEL_FAILED:
+			logerr("model %d failed to load", model->number);
+			return -1;
+		case CGPS_MODEL_UNLOADED:
+			if(__sync_bool_compare_and_swap(&model->state, CGPS_MODEL_UNLOADED, CGPS_MODEL_LOADING)) {
+				if((status = cgps_project_load_model(proj, model)) < 0) {
+					logerr("failed load metadata for model index %d", model->index);
+				}
+				
+				/*
+				 * Setup native engine parameters. The models not supported by 
+				 * the native engine are predicted by SIMCA-QP.
+				 */
+				if(status == 0 && model->fitted && proj->opts->engine == CGPS_ENGINE_NATIVE) {
+					if(cgps_native_load(proj, model) < 0) {
+						debug("using SIMCA-QP for predicting model %d", model->number);
+					}
+				}
+				__sync_bool_compare_and_swap(&model->state, CGPS_MODEL_LOADING, 
+							     status < 0 ? CGPS_MODEL_FAILED : CGPS_MODEL_LOADED);
+				return status;
+			}
+			break;
+		default:
+#ifdef HAVE_SCHED_YIELD
+			sched_yield();
+#endif
+			break;
+		}
+	}
+}
+
+/*
+ * Get model descriptor by model index. Returns NULL if not found.
+ */
+struct cgps_model * cgps_project_model_index(struct cgps_project *proj, int index)
+{
+	if(index < 1 || index > proj->models || !proj->model) {
+		logerr("model index %d is out of range (1-%d)", index, proj->models);
+		return NULL;
+	}
+	if(cgps_project_model_ensure(proj, &proj->model[index - 1]) < 0) {
+		return NULL;
+	}
+	return &proj->model[index - 1];
+}
+
+/*
+ * Get model descriptor by model number. Returns NULL if not found.
+ */
+struct cgps_model * cgps_project_model_number(struct cgps_project *proj, int number)
+{
+	int i;
+	
+	for(i = 0; i < proj->models && proj->model; ++i) {
+		if(proj->model[i].number == number) {
+			if(cgps_project_model_ensure(proj, &proj->model[i]) < 0) {
+				return NULL;
+			}
+			return &proj->model[i];
+		}
+	}
+	logerr("no model with model number %d in project", number);
+	return NULL;
+}
+
+/*
+ * Apply the process wide SIMCA-QP settings (license, log file and threading) 
+ * from the library options.
+ */
+static int cgps_project_setup(struct cgps_project *proj)
+{
+	struct cgps_options *opts = proj->opts;
 	
 	if(!opts->license) {
 		opts->license = getenv("SIMCAQLICENSE");
@@ -133,6 +326,53 @@ int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_o
 		}
 	}
 	
+	return 0;
+}
+
+/*
+ * Initilize the project and set default options.
+ */
+static int cgps_project_init(struct cgps_project *proj, struct cgps_options *opts)
+{
+	memset(proj, 0, sizeof(struct cgps_project));	
+	proj->opts = opts;
+	
+	/*
+	 * Set default options:
+	 */
+	if(!opts->prog) {
+		opts->prog = PACKAGE_NAME;
+	}	
+	if(!opts->logger) {
+		opts->logger = cgps_stderr_logger;
+	}
+	if(!opts->format) {
+		opts->format = CGPS_OUTPUT_FORMAT_DEFAULT;
+	}
+	if(!opts->indata) {
+		logerr("data loader function is not set in library options");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Loads the project in path.
+ */
+int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_options *opts)
+{
+#if ! defined(__linux__)
+	char *version;               /* Simca-Q dll-version */
+#endif
+	int i;
+
+	if(cgps_project_init(proj, opts) < 0) {
+		return -1;
+	}
+	if(cgps_project_setup(proj) < 0) {
+		return -1;
+	}
+	
 	if(!SQX_AddProject(path, 1, NULL, &proj->handle)) {
 		/*
 		 * We better give up if loading project fails.
@@ -142,7 +382,7 @@ int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_o
 	}
 	debug("successful loaded project %s", path);
 	
-	if(opts->debug) {
+	if(opts->debug && !opts->lazy) {
 #if ! defined(__linux__)
 		if(!SQX_GetVersionNumber(&version)) {
 			logerr("failed get Simca-Q version (%s)", cgps_simcaq_error());
@@ -175,6 +415,64 @@ int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_o
 	} else {
 		debug("project contains %d number of models", proj->models);
 	}
+	
+	if(cgps_project_load_flags(proj) < 0) {
+		logerr("failed get project flags");
+		cgps_project_close(proj);
+		return -1;
+	}
+	
+	if(proj->models > 0) {
+		proj->model = calloc(proj->models, sizeof(struct cgps_model));
+		if(!proj->model) {
+			logerr("failed alloc memory");
+			cgps_project_close(proj);
+			return -1;
+		}
+		for(i = 0; i < proj->models; ++i) {
+			struct cgps_model *model = &proj->model[i];
+			
+			model->index = i + 1;
+			if(!SQX_GetModelNumber(proj->handle, model->index, &model->number)) {
+				logerr("failed get model number for model index %d", model->index);
+				cgps_project_close(proj);
+				return -1;
+			} else {
+				debug("got model number %d for model index %d", model->number, model->index);
+			}
+		}
+	}
+	
+	/*
+	 * In lazy mode, the models are loaded on first use. A model that fails
+	 * to load is left in failed state (only predictions against it fail),
+	 * the same as in lazy mode.
+	 */
+	if(!opts->lazy) {
+		for(i = 0; i < proj->models; ++i) {
+			if(cgps_project_model_ensure(proj, &proj->model[i]) < 0) {
+				logwarn("model %d is not usable (continue loading project)", proj->model[i].number);
+			}
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * Loads the model file in path exported by cgps_model_export(). No SIMCA-QP
+ * project is loaded, the models are predicted by the native engine using the
+ * parameters direct from the read-only mapping of the file.
+ */
+int cgps_project_load_mapped(struct cgps_project *proj, const char *path, struct cgps_options *opts)
+{
+	if(cgps_project_init(proj, opts) < 0) {
+		return -1;
+	}
+	if(cgps_mapped_open(proj, path) < 0) {
+		cgps_project_close(proj);
+		return -1;
+	}
 	return 0;
 }
 
@@ -183,11 +481,108 @@ int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_o
  */
 void cgps_project_close(struct cgps_project *proj)
 {
+	int i;
+	
+	if(proj->model) {
+		for(i = 0; i < proj->models; ++i) {
+			cgps_project_free_model(&proj->model[i]);
+		}
+		free(proj->model);
+		proj->model = NULL;
+	}
 	if(proj->handle) {
 		if(!SQX_RemoveProject(proj->handle)) {
 			logerr("failed remove Simca-Q project");
 		} else {
 			debug("successful closed project");
 		}
+		proj->handle = 0;
+	}
+	if(proj->mapped) {
+		cgps_mapped_close(proj);
+		proj->name = NULL;
+		debug("successful closed model file");
+	}
+}
+
+/*
+ * Prepare the project for being shared with child processes. All models are
+ * loaded (models failing to load are left in failed state) and pending 
+ * output is flushed, so the loaded project pages can be shared copy-on-write
+ * by the child processes.
+ */
+int cgps_project_prefork(struct cgps_project *proj)
+{
+	int i;
+	
+	if(!cgps_project_isopen(proj)) {
+		logerr("no valid project handle");
+		return -1;
+	}
+	if(proj->models > 0 && !proj->model) {
+		logerr("model metadata is not loaded");
+		return -1;
+	}
+	for(i = 0; i < proj->models; ++i) {
+		if(cgps_project_model_ensure(proj, &proj->model[i]) < 0) {
+			logwarn("model %d is not usable in child processes", proj->model[i].number);
+		}
+	}
+	
+	fflush(NULL);
+	proj->pid = getpid();
+	debug("project is prepared for fork (pid %d)", proj->pid);
+	return 0;
+}
+
+/*
+ * Restore per process state in a child process. The SIMCA-QP settings are 
+ * applied again because threads and open files of the parent are not (safe) 
+ * to use in the child. This function must be called direct after fork, before
+ * any thread in the child uses the project.
+ */
+int cgps_project_postfork(struct cgps_project *proj)
+{
+	proj->pid = getpid();
+	
+#ifdef HAVE_SYSLOG_H
+	if(proj->opts->syslog) {
+		closelog();      /* reopened on next call to syslog() */
+	}
+#endif
+	if(proj->handle && cgps_project_setup(proj) < 0) {
+		logerr("failed setup project in child process %d", proj->pid);
+		return -1;
+	}
+	
+	debug("project setup done in child process %d", proj->pid);
+	return 0;
+}
+
+/*
+ * Fork a worker process that shares the loaded project with the parent. 
+ * Returns the same values as fork(2).
+ */
+int cgps_project_fork(struct cgps_project *proj)
+{
+	pid_t pid;
+	
+	if(cgps_project_prefork(proj) < 0) {
+		return -1;
+	}
+	
+	if((pid = fork()) < 0) {
+		logerr("failed fork worker process");
+		return -1;
+	}
+	if(pid == 0) {
+		if(cgps_project_postfork(proj) < 0) {
+			/*
+			 * Returning -1 would make the caller continue as the parent.
+			 */
+			logerr("terminating worker process %d", (int)getpid());
+			_exit(EXIT_FAILURE);
+		}
 	}
+	return pid;
 }
@@ -0,0 +1,189 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Reloadable projects. The published project is reference counted: the live
+ * struct holds one reference and each cgps_project_acquire() another. A 
+ * reload loads the new project (with all models) while predictions continues
+ * using the old one, then replaces the published project and drops its 
+ * reference. The old project is closed (SQX_RemoveProject) by whoever 
+ * releases the last reference, i.e. after the last prediction using it.
+ * 
+ * The lock is only held while reading or swapping the published pointer 
+ * and updating the reference count, never while loading or predicting.
+ */
+
+static void cgps_project_live_lock(struct cgps_project_live *live)
+{
+	while(__sync_lock_test_and_set(&live->lock, 1)) {
+#ifdef HAVE_SCHED_YIELD
+		sched_yield();
+#endif
+	}
+}
+
+static void cgps_project_live_unlock(struct cgps_project_live *live)
+{
+	__sync_lock_release(&live->lock);
+}
+
+/*
+ * Load a new project from path. All models are loaded (also in lazy mode), 
+ * so the first predictions after publishing it don't pay for loading.
+ */
+static struct cgps_project * cgps_project_live_open(struct cgps_project_live *live, const char *path)
+{
+	struct cgps_project *proj;
+	int i;
+	
+	if(!(proj = malloc(sizeof(struct cgps_project)))) {
+		return NULL;
+	}
+	if(cgps_project_load(proj, path, live->opts) < 0) {
+		free(proj);
+		return NULL;
+	}
+	for(i = 0; i < proj->models; ++i) {
+		if(!cgps_project_model_index(proj, i + 1)) {
+			cgps_project_close(proj);
+			free(proj);
+			return NULL;
+		}
+	}
+	proj->refs = 1;
+	return proj;
+}
+
+/*
+ * Load the project in path as a reloadable project.
+ */
+int cgps_project_live_load(struct cgps_project_live *live, const char *path, struct cgps_options *opts)
+{
+	memset(live, 0, sizeof(struct cgps_project_live));
+	live->opts = opts;
+	
+	if(!(live->proj = cgps_project_live_open(live, path))) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Get the current project for making predictions. The project stays valid
+ * until released, even if the project is reloaded meanwhile. Returns NULL 
+ * if the live project is closed.
+ */
+struct cgps_project * cgps_project_acquire(struct cgps_project_live *live)
+{
+	struct cgps_project *proj;
+	
+	cgps_project_live_lock(live);
+	if((proj = live->proj)) {
+		__sync_fetch_and_add(&proj->refs, 1);
+	}
+	cgps_project_live_unlock(live);
+	
+	return proj;
+}
+
+/*
+ * Release a project returned by cgps_project_acquire(). The project is closed
+ * if this was the last reference on a replaced project.
+ */
+void cgps_project_release(struct cgps_project *proj)
+{
+	if(!proj) {
+		return;
+	}
+	if(__sync_sub_and_fetch(&proj->refs, 1) == 0) {
+		debug("closing replaced project %s", proj->name ? proj->name : "");
+		cgps_project_close(proj);
+		free(proj);
+	}
+}
+
+/*
+ * Load the project in path and publish it as the current project. The
+ * current project is kept if the new project fails to load. Predictions 
+ * in progress are not blocked, so this function is normally called from 
+ * a background thread.
+ */
+int cgps_project_reload(struct cgps_project_live *live, const char *path)
+{
+	struct cgps_project *proj, *old;
+	
+	if(!(proj = cgps_project_live_open(live, path))) {
+		if((proj = cgps_project_acquire(live))) {
+			logerr("failed reload project %s (keeping current project)", path);
+			cgps_project_release(proj);
+		}
+		return -1;
+	}
+	
+	cgps_project_live_lock(live);
+	old = live->proj;
+	live->proj = proj;
+	cgps_project_live_unlock(live);
+	
+	debug("published reloaded project %s", path);
+	cgps_project_release(old);
+	return 0;
+}
+
+/*
+ * Close the reloadable project. The project is closed when the last 
+ * prediction using it has released it.
+ */
+void cgps_project_live_close(struct cgps_project_live *live)
+{
+	struct cgps_project *proj;
+	
+	cgps_project_live_lock(live);
+	proj = live->proj;
+	live->proj = NULL;
+	cgps_project_live_unlock(live);
+	
+	cgps_project_release(proj);
+}
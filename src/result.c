@@ -29,9 +29,15 @@
 # include "config.h"
 #endif
 
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
 #include <SQXCInterface.h>
 #include <SQPCInterface.h>
 
@@ -111,123 +117,130 @@ const struct cgps_result_entry * cgps_result_entry_name(int value)
 }
 
 /*
- * Print a single floating point number.
+ * Pass a single floating point number to the result sink.
  */
-static void cgps_result_print_single_value(struct cgps_project *proj, FILE *out, float f)
+static int cgps_result_print_single_value(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry, float f)
 {
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_PLAIN) {
-		fprintf(out, "%f\t\n", f);
-	}
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_XML) {
-		fprintf(out, "    <values num=\"1\">\n");
-		fprintf(out, "      <value>%f</value>\n", f);
-		fprintf(out, "    </values>\n");
+	int status = 0;
+	
+	if(res->sink->matrix) {
+		if((status = res->sink->matrix(proj, res->data, entry, &f, 1, 1)) < 0) {
+			logerr("result sink failed for %s", entry->desc);
+		}
 	}
+	return status;
 }
 
 /*
- * Print a float point matrix as a tab separated table.
+ * Pass the extracted matrix values to the result sink.
  */
-static int cgps_result_print_matrix_plain(struct cgps_project *proj, FILE *out, SQX_FloatMatrix *matrix)
+static int cgps_result_print_values(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry, const struct cgps_matrix *values)
 {
-	float f;
-	int i, j;
+	int status = 0;
 	
-	for(i = 0; i < SQX_GetNumColumnsInFloatMatrix(matrix); ++i) {
-		for(j = 0; j < SQX_GetNumRowsInFloatMatrix(matrix); ++j) {
-			if(!SQX_GetDataFromFloatMatrix(matrix, j + 1, i + 1, &f)) {
-				logerr("failed get float value from matrix (%s)", cgps_simcaq_error());
-				SQX_ClearFloatMatrix(matrix);
-				return -1;
-			}
-			fprintf(out, "%f\t", f);
+	if(res->sink->matrix) {
+		if((status = res->sink->matrix(proj, res->data, entry, values->data, values->rows, values->cols)) < 0) {
+			logerr("result sink failed for %s", entry->desc);
 		}
-		fprintf(out, "\n");
 	}
-
-	SQX_ClearFloatMatrix(matrix);
-	return 0;
+	return status;
 }
 
 /*
- * Print a float point matrix in XML output format.
+ * Pass a float point matrix to the result sink. The values are extracted from
+ * the SIMCA-QP matrix once into the matrix kept for this result type and the
+ * SIMCA-QP matrix is cleared.
  */
-static int cgps_result_print_matrix_xml(struct cgps_project *proj, FILE *out, SQX_FloatMatrix *matrix)
+static int cgps_result_print_matrix(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry, SQX_FloatMatrix *matrix)
 {
-	float f;
-	int i, j, cols, rows;
-
-	cols = SQX_GetNumColumnsInFloatMatrix(matrix);
-	rows = SQX_GetNumRowsInFloatMatrix(matrix);
+	struct cgps_matrix *values = &res->values[entry->value];
 	
-	for(i = 0; i < cols; ++i) {
-		fprintf(out, "    <values num=\"%d\">\n      ", rows);
-		for(j = 0; j < rows; ++j) {
-			if(!SQX_GetDataFromFloatMatrix(matrix, j + 1, i + 1, &f)) {
-				logerr("failed get float value from matrix (%s)", cgps_simcaq_error());
-				SQX_ClearFloatMatrix(matrix);
-				return -1;
-			}
-			fprintf(out, "<value>%f</value>", f);
-		}
-		fprintf(out, "\n    </values>\n");
+	if(cgps_matrix_resize(values, SQX_GetNumRowsInFloatMatrix(matrix), SQX_GetNumColumnsInFloatMatrix(matrix)) < 0) {
+		logerr("failed alloc memory");
+		SQX_ClearFloatMatrix(matrix);
+		return -1;
+	}
+	if(cgps_matrix_read(proj, matrix, values->data) < 0) {
+		SQX_ClearFloatMatrix(matrix);
+		return -1;
 	}
-
 	SQX_ClearFloatMatrix(matrix);
-	return 0;
+	
+	return cgps_result_print_values(proj, res, entry, values);
 }
 
 /*
- * Print a float point matrix as a tab separated table.
+ * Output a complete result from a SIMCA-QP matrix. The result is always 
+ * ended in the sink, -1 is returned if any of the sink calls failed.
  */
-static int cgps_result_print_matrix(struct cgps_project *proj, FILE *out, SQX_FloatMatrix *matrix)
+static int cgps_result_print_result(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry, SQX_FloatMatrix *matrix)
 {
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_PLAIN) {
-		return cgps_result_print_matrix_plain(proj, out, matrix);
+	int status = 0;
+	
+	if(cgps_result_print_header(proj, res, entry) < 0) {
+		status = -1;
 	}
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_XML) {
-		return cgps_result_print_matrix_xml(proj, out, matrix);
+	if(cgps_result_print_matrix(proj, res, entry, matrix) < 0) {
+		status = -1;
 	}
-	
-	/*
-	 * Impossible case, but keeps gcc happy :-)
-	 */
-	logerr("wrong output format for matrix output (expected xml or plain)");
-	return -1;
+	if(cgps_result_print_footer(proj, res, entry) < 0) {
+		status = -1;
+	}
+	return status;
 }
 
 /*
- * Print header for result dump.
+ * Output result computed by the native engine.
  */
-void cgps_result_print_header(struct cgps_project *proj, FILE *fs, const char *title, const char *name)
+static int cgps_result_print_native(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, const struct cgps_result_entry *entry, int (*getter)(struct cgps_project *, struct cgps_predict *, struct cgps_matrix *))
 {
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_PLAIN) {
-		if(proj->opts->verbose) {
-			fprintf(fs, "# ----------------------------------------------\n");
-			fprintf(fs, "# %s (%s):\n", title, name);
-			fprintf(fs, "# ----------------------------------------------\n");
-		}
+	struct cgps_matrix *values = &res->values[entry->value];
+	int status = 0;
+	
+	if(getter(proj, pred, values) < 0) {
+		logerr("failed get result of %s", entry->desc);
+		return -1;
 	}
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_XML) {
-		if(proj->opts->verbose) {
-			fprintf(fs, "  <prediction name=\"%s\" desc=\"%s\">\n", name, title);
-		} else {
-			fprintf(fs, "  <prediction name=\"%s\">\n", name);
-		}
+	if(cgps_result_print_header(proj, res, entry) < 0) {
+		status = -1;
+	}
+	if(cgps_result_print_values(proj, res, entry, values) < 0) {
+		status = -1;
+	}
+	if(cgps_result_print_footer(proj, res, entry) < 0) {
+		status = -1;
 	}
+	return status;
 }
 
 /*
- * Print footer for result dump.
+ * Begin result in sink.
  */
-void cgps_result_print_footer(struct cgps_project *proj, FILE *fs)
+int cgps_result_print_header(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry)
 {
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_PLAIN) {		
-		fprintf(fs, "\n");
+	int status = 0;
+	
+	if(res->sink->begin_result) {
+		if((status = res->sink->begin_result(proj, res->data, entry)) < 0) {
+			logerr("result sink failed to begin %s", entry->desc);
+		}
 	}
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_XML) {
-		fprintf(fs, "  </prediction>\n");
+	return status;
+}
+
+/*
+ * End result in sink.
+ */
+int cgps_result_print_footer(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry)
+{
+	int status = 0;
+	
+	if(res->sink->end_result) {
+		if((status = res->sink->end_result(proj, res->data, entry)) < 0) {
+			logerr("result sink failed to end %s", entry->desc);
+		}
 	}
+	return status;
 }
 
 /*
@@ -236,26 +249,35 @@ void cgps_result_print_footer(struct cgps_project *proj, FILE *fs)
 int cgps_result_contrib_ssw(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
+	int obs, status = 0;
 	
 	entry = cgps_result_entry_name(PREDICTED_CONTRIB_SSW);	
-	if(!SQP_GetPredictedContributionsSSW(pred->handle, 
-					     -1,           /* model number, not used */
-					     0,            /* iObs1Ix */ 
-					     1,            /* iObs2Ix */ 
-					     SQX_NoWeight, 
-					     numcomp, 
-					     1, 
-					     0,            /* bReconstruct */ 
-					     &res->matrix)) {
-		logerr("failed get result of %s", entry->desc);
-		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
+	if(cgps_result_print_header(proj, res, entry) < 0) {
+		status = -1;
+	}
+	for(obs = 1; obs <= pred->obs; ++obs) {
+		if(!SQP_GetPredictedContributionsSSW(pred->handle, 
+						     -1,           /* model number, not used */
+						     0,            /* iObs1Ix */ 
+						     obs,          /* iObs2Ix */ 
+						     SQX_NoWeight, 
+						     numcomp, 
+						     1, 
+						     0,            /* bReconstruct */ 
+						     &res->matrix)) {
+			logerr("failed get result of %s (observation %d)", entry->desc, obs);
+			cgps_result_print_footer(proj, res, entry);
+			return -1;
+		}
+		if(cgps_result_print_matrix(proj, res, entry, &res->matrix) < 0) {
+			status = -1;
+		}
+	}
+	if(cgps_result_print_footer(proj, res, entry) < 0) {
+		status = -1;
 	}
 	
-	return 0;
+	return status;
 }
 
 int cgps_result_contrib_ssw_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -275,43 +297,52 @@ int cgps_result_contrib_ssw_group(struct cgps_project *proj, struct cgps_predict
 						  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 		
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_contrib_smw(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res)
+int cgps_result_contrib_smw(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
+	int obs, status = 0;
+	
+	(void)numcomp;
 	
 	entry = cgps_result_entry_name(PREDICTED_CONTRIB_SMW);
-	if(!SQP_GetPredictedContributionsSMW(pred->handle, 
-					     -1,           /* model number, not used */
-					     0,            /* iObs1Ix */
-					     1,            /* iObs2Ix */
-					     SQX_P, 
-					     NULL,         /* pComponents */
-					     0,            /* bReconstruct */
-					     &res->matrix)) {
-		logerr("failed get result of %s", entry->desc);
-		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
+	if(cgps_result_print_header(proj, res, entry) < 0) {
+		status = -1;
+	}
+	for(obs = 1; obs <= pred->obs; ++obs) {
+		if(!SQP_GetPredictedContributionsSMW(pred->handle, 
+						     -1,           /* model number, not used */
+						     0,            /* iObs1Ix */
+						     obs,          /* iObs2Ix */
+						     SQX_P, 
+						     NULL,         /* pComponents */
+						     0,            /* bReconstruct */
+						     &res->matrix)) {
+			logerr("failed get result of %s (observation %d)", entry->desc, obs);
+			cgps_result_print_footer(proj, res, entry);
+			return -1;
+		}
+		if(cgps_result_print_matrix(proj, res, entry, &res->matrix) < 0) {
+			status = -1;
+		}
+	}
+	if(cgps_result_print_footer(proj, res, entry) < 0) {
+		status = -1;
 	}
 	
-	return 0;
+	return status;
 }
 
-int cgps_result_contrib_smw_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res)
+int cgps_result_contrib_smw_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
+	(void)numcomp;
+	
 	entry = cgps_result_entry_name(PREDICTED_CONTRIB_SMW_GROUP);
 	if(!SQP_GetPredictedContributionsSMWGroup(pred->handle, 
 						  -1,      /* model number, not used */
@@ -323,37 +354,55 @@ int cgps_result_contrib_smw_group(struct cgps_project *proj, struct cgps_predict
 						  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_contrib_dmod_x(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
+	int obs, status = 0;
 	
 	entry = cgps_result_entry_name(PREDICTED_CONTRIB_DMOD_X);
-	if(!SQP_GetPredictedContributionsDModX(pred->handle, 
-					       -1,         /* model number, not used */ 
-					       1,          /* iObsIx */
-					       SQX_RX, 
-					       numcomp, 
-					       1, 
-					       0,          /* bReconstruct */
-					       &res->matrix)) {
-		logerr("failed get result of %s", entry->desc);
-		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
+	if(cgps_result_print_header(proj, res, entry) < 0) {
+		status = -1;
+	}
+	for(obs = 1; obs <= pred->obs; ++obs) {
+		if(pred->native) {
+			struct cgps_matrix *values = &res->values[entry->value];
+			
+			if(cgps_native_contrib_dmod_x(proj, pred, obs, values) < 0) {
+				logerr("failed get result of %s (observation %d)", entry->desc, obs);
+				cgps_result_print_footer(proj, res, entry);
+				return -1;
+			}
+			if(cgps_result_print_values(proj, res, entry, values) < 0) {
+				status = -1;
+			}
+			continue;
+		}
+		if(!SQP_GetPredictedContributionsDModX(pred->handle, 
+						       -1,         /* model number, not used */ 
+						       obs,        /* iObsIx */
+						       SQX_RX, 
+						       numcomp, 
+						       1, 
+						       0,          /* bReconstruct */
+						       &res->matrix)) {
+			logerr("failed get result of %s (observation %d)", entry->desc, obs);
+			cgps_result_print_footer(proj, res, entry);
+			return -1;
+		}
+		if(cgps_result_print_matrix(proj, res, entry, &res->matrix) < 0) {
+			status = -1;
+		}
+	}
+	if(cgps_result_print_footer(proj, res, entry) < 0) {
+		status = -1;
 	}
 	
-	return 0;
+	return status;
 }
 
 int cgps_result_contrib_dmod_x_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -371,22 +420,21 @@ int cgps_result_contrib_dmod_x_group(struct cgps_project *proj, struct cgps_pred
 						    &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
-	SQX_ClearIntVector(&res->index1);
-	SQX_ClearIntVector(&res->index2);
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_dmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res)
+int cgps_result_dmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
+	(void)numcomp;
+	
 	entry = cgps_result_entry_name(PREDICTED_DMOD_X_PS);
+	if(pred->native) {
+		return cgps_result_print_native(proj, pred, res, entry, cgps_native_dmod_x);
+	}
 	if(!SQP_GetPredictedDModX(pred->handle, 
 				  -1,                      /* model number, not used */
 				  NULL,                    /* pnComponentList */
@@ -395,19 +443,17 @@ int cgps_result_dmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred,
 				  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_dmod_x_ps_comb(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res)
+int cgps_result_dmod_x_ps_comb(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
+	(void)numcomp;
+	
 	entry = cgps_result_entry_name(PREDICTED_DMOD_X_PS_COMB);
 	if(!SQP_GetPredictedDModXCombined(pred->handle, 
 					  -1,              /* model number, not used */
@@ -417,39 +463,38 @@ int cgps_result_dmod_x_ps_comb(struct cgps_project *proj, struct cgps_predict *p
 					  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_pmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res)
+int cgps_result_pmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
+	(void)numcomp;
+	
 	entry = cgps_result_entry_name(PREDICTED_PMOD_X_PS);
+	if(pred->native) {
+		return cgps_result_print_native(proj, pred, res, entry, cgps_native_pmod_x);
+	}
 	if(!SQP_GetPredictedPModX(pred->handle, 
 				  -1,                      /* model number, not used */
 				  NULL,                    /* pnComponentList */
 				  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_pmod_x_comb_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res)
+int cgps_result_pmod_x_comb_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
+	(void)numcomp;
+	
 	entry = cgps_result_entry_name(PREDICTED_PMOD_X_COMB_PS);
 	if(!SQP_GetPredictedPModXCombined(pred->handle, 
 					  -1,              /* model number, not used */
@@ -457,23 +502,20 @@ int cgps_result_pmod_x_comb_ps(struct cgps_project *proj, struct cgps_predict *p
 					  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_tps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 
+	(void)numcomp;
+
 	entry = cgps_result_entry_name(PREDICTED_TPS);
-	if(numcomp <= 0) {
-		logwarn("%s is not valid for a zero component model (skipped)", entry->desc);
-		return -1;
+	if(pred->native) {
+		return cgps_result_print_native(proj, pred, res, entry, cgps_native_tps);
 	}
 	if(!SQP_GetPredictedT(pred->handle, 
 			      -1,                          /* model number, not used */
@@ -481,13 +523,9 @@ int cgps_result_tps(struct cgps_project *proj, struct cgps_predict *pred, struct
 			      &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_tcv_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -495,23 +533,15 @@ int cgps_result_tcv_ps(struct cgps_project *proj, struct cgps_predict *pred, str
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_TCV_PS);
-	if(numcomp <= 0) {
-		logwarn("%s is not valid for a zero component model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedTcv(pred->handle, 
 				-1,                        /* model number, not used */
 				numcomp, 
 				&res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_tcv_seps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -519,48 +549,42 @@ int cgps_result_tcv_seps(struct cgps_project *proj, struct cgps_predict *pred, s
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_TCV_SEPS);
-	if(numcomp <= 0) {
-		logwarn("%s is not valid for a zero component model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedTcvSE(pred->handle, 
 				  -1,                      /* model number, not used */
 				  numcomp, 
 				  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_tcv_sed_fps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
+	int status = 0;
 	float f;
 	
 	entry = cgps_result_entry_name(PREDICTED_TCV_SED_FPS);
-	if(numcomp <= 0) {
-		logwarn("%s is not valid for a zero component model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedTcvSEDF(pred->handle, 
 				    -1,                    /* model number, not used */
 				    numcomp, 
 				    &f)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_single_value(proj, res->out, f);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	if(cgps_result_print_header(proj, res, entry) < 0) {
+		status = -1;
+	}
+	if(cgps_result_print_single_value(proj, res, entry, f) < 0) {
+		status = -1;
+	}
+	if(cgps_result_print_footer(proj, res, entry) < 0) {
+		status = -1;
+	}
+	return status;
 }
 	
 int cgps_result_t2_range_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -568,6 +592,9 @@ int cgps_result_t2_range_ps(struct cgps_project *proj, struct cgps_predict *pred
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_T2_RANGE_PS);
+	if(pred->native) {
+		return cgps_result_print_native(proj, pred, res, entry, cgps_native_t2_range);
+	}
 	if(!SQP_GetPredictedT2Range(pred->handle, 
 				    -1,                    /* model number, not used */
 				    1,    
@@ -575,13 +602,9 @@ int cgps_result_t2_range_ps(struct cgps_project *proj, struct cgps_predict *pred
 				    &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_x_obs_res_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -589,6 +612,9 @@ int cgps_result_x_obs_res_ps(struct cgps_project *proj, struct cgps_predict *pre
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_X_OBS_RES_PS);
+	if(pred->native) {
+		return cgps_result_print_native(proj, pred, res, entry, cgps_native_x_obs_res);
+	}
 	if(!SQP_GetPredictedXObsRes(pred->handle, 
 				    -1,                   /* model number, not used */
 				    numcomp, 
@@ -599,13 +625,9 @@ int cgps_result_x_obs_res_ps(struct cgps_project *proj, struct cgps_predict *pre
 				    &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_x_obs_pred_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -623,19 +645,17 @@ int cgps_result_x_obs_pred_ps(struct cgps_project *proj, struct cgps_predict *pr
 				     &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_x_var_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res)
+int cgps_result_x_var_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
+	(void)numcomp;
+	
 	entry = cgps_result_entry_name(PREDICTED_X_VAR_PS);
 	if(!SQP_GetPredictedXVar(pred->handle, 
 				 -1,                      /* model number, not used */
@@ -645,13 +665,9 @@ int cgps_result_x_var_ps(struct cgps_project *proj, struct cgps_predict *pred, s
 				 &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_x_var_res_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -669,31 +685,16 @@ int cgps_result_x_var_res_ps(struct cgps_project *proj, struct cgps_predict *pre
 				    &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_serr_lps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp, int isresuinc)
+int cgps_result_serr_lps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {	
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_SERR_LPS);
-	if(!(res->type == SQX_PLS_Class) || 
-	    (res->type == SQX_PLS) || 
-	    (res->type == SQX_PLS_DA)) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
-	if(isresuinc != 1) {
-		logwarn("%s is only valid if model residuals is still in the project (skipped)", 
-			entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedSerrL(pred->handle, 
 				  -1,                      /* model number, not used */
 				  numcomp, 
@@ -701,31 +702,16 @@ int cgps_result_serr_lps(struct cgps_project *proj, struct cgps_predict *pred, s
 				  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
-int cgps_result_serr_ups(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp, int isresuinc)
+int cgps_result_serr_ups(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_SERR_UPS);
-	if(!(res->type == SQX_PLS_Class) || 
-	    (res->type == SQX_PLS) || 
-	    (res->type == SQX_PLS_DA)) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
-	if(isresuinc != 1) {
-		logwarn("%s is only valid if model residuals is still in the project (skipped)", 
-			entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedSerrU(pred->handle, 
 				  -1,                      /* model number, not used */
 				  numcomp, 
@@ -733,13 +719,9 @@ int cgps_result_serr_ups(struct cgps_project *proj, struct cgps_predict *pred, s
 				  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_y_pred_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -747,12 +729,8 @@ int cgps_result_y_pred_ps(struct cgps_project *proj, struct cgps_predict *pred,
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_Y_PRED_PS);
-	if(!((numcomp > 0) && 
-	    ((res->type == SQX_PLS_Class) || 
-	     (res->type == SQX_PLS) || 
-	     (res->type == SQX_PLS_DA)))) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
+	if(pred->native) {
+		return cgps_result_print_native(proj, pred, res, entry, cgps_native_y_pred);
 	}
 	if(!SQP_GetPredictedY(pred->handle, 
 			      -1,                          /* model number, not used */
@@ -763,13 +741,9 @@ int cgps_result_y_pred_ps(struct cgps_project *proj, struct cgps_predict *pred,
 			      &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_y_pred_cv_conf_int_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -777,13 +751,6 @@ int cgps_result_y_pred_cv_conf_int_ps(struct cgps_project *proj, struct cgps_pre
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_Y_PRED_CV_CONF_INT_PS);
-	if(!((numcomp > 0) && 
-	    ((res->type == SQX_PLS_Class) || 
-	     (res->type == SQX_PLS) || 
-	     (res->type == SQX_PLS_DA)))) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedYPredCVConfInt(pred->handle, 
 					   -1,             /* model number, not used */
 					   numcomp, 
@@ -793,13 +760,9 @@ int cgps_result_y_pred_cv_conf_int_ps(struct cgps_project *proj, struct cgps_pre
 					   &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_y_cv_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -807,13 +770,6 @@ int cgps_result_y_cv_ps(struct cgps_project *proj, struct cgps_predict *pred, st
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_Y_CV_PS);
-	if(!((numcomp > 0) && 
-	    ((res->type == SQX_PLS_Class) || 
-	     (res->type == SQX_PLS) || 
-	     (res->type == SQX_PLS_DA)))) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedYCV(pred->handle, 
 				-1,                        /* model number, not used */
 				numcomp, 
@@ -823,13 +779,9 @@ int cgps_result_y_cv_ps(struct cgps_project *proj, struct cgps_predict *pred, st
 				&res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_y_cv_seps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -837,13 +789,6 @@ int cgps_result_y_cv_seps(struct cgps_project *proj, struct cgps_predict *pred,
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_Y_CV_SEPS);
-	if(!((numcomp > 0) && 
-	    ((res->type == SQX_PLS_Class) || 
-	     (res->type == SQX_PLS) || 
-	     (res->type == SQX_PLS_DA)))) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedYCVSE(pred->handle, 
 				  -1,                      /* model number, not used */
 				  numcomp, 
@@ -851,13 +796,9 @@ int cgps_result_y_cv_seps(struct cgps_project *proj, struct cgps_predict *pred,
 				  &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_y_obs_res_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -865,13 +806,6 @@ int cgps_result_y_obs_res_ps(struct cgps_project *proj, struct cgps_predict *pre
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_Y_OBS_RES_PS);
-	if(!((numcomp > 0) && 
-	    ((res->type == SQX_PLS_Class) || 
-	     (res->type == SQX_PLS) || 
-	     (res->type == SQX_PLS_DA)))) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedYObsRes(pred->handle, 
 				    -1,                    /* model number, not used */
 				    numcomp, 
@@ -881,27 +815,18 @@ int cgps_result_y_obs_res_ps(struct cgps_project *proj, struct cgps_predict *pre
 				    &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_y_var_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
 {
 	const struct cgps_result_entry *entry;
 	
+	(void)numcomp;
+	
 	entry = cgps_result_entry_name(PREDICTED_Y_VAR_PS);
-	if(!((numcomp > 0) && 
-	    ((res->type == SQX_PLS_Class) || 
-	     (res->type == SQX_PLS) || 
-	     (res->type == SQX_PLS_DA)))) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedYVar(pred->handle, 
 				 -1,                       /* model number, not used */
 				 1,                        /* bUnscaled */
@@ -910,13 +835,9 @@ int cgps_result_y_var_ps(struct cgps_project *proj, struct cgps_predict *pred, s
 				 &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
-	return 0;
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
 }
 
 int cgps_result_y_var_res_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp)
@@ -924,13 +845,6 @@ int cgps_result_y_var_res_ps(struct cgps_project *proj, struct cgps_predict *pre
 	const struct cgps_result_entry *entry;
 	
 	entry = cgps_result_entry_name(PREDICTED_Y_VAR_RES_PS);
-	if(!((numcomp > 0) && 
-	    ((res->type == SQX_PLS_Class) || 
-	     (res->type == SQX_PLS) || 
-	     (res->type == SQX_PLS_DA)))) {
-		logwarn("%s is only valid for a PLS model (skipped)", entry->desc);
-		return -1;
-	}
 	if(!SQP_GetPredictedYVarRes(pred->handle, 
 				    -1,                    /* model number, not used */
 				    numcomp, 
@@ -941,32 +855,76 @@ int cgps_result_y_var_res_ps(struct cgps_project *proj, struct cgps_predict *pre
 				    &res->matrix)) {
 		logerr("failed get result of %s", entry->desc);
 		return -1;
-	} else {
-		cgps_result_print_header(proj, res->out, entry->desc, entry->name);
-		cgps_result_print_matrix(proj, res->out, &res->matrix);
-		cgps_result_print_footer(proj, res->out);
 	}
 	
+	return cgps_result_print_result(proj, res, entry, &res->matrix);
+}
+
+/*
+ * Setup the observation index vectors used by the group contributions.
+ */
+static void cgps_result_init_index(struct cgps_result *res)
+{
+	SQX_InitIntVector(&res->index1, 2);
+	SQX_SetDataInIntVector(&res->index1, 1, 1);
+	SQX_SetDataInIntVector(&res->index1, 2, 2);
+	
+	SQX_InitIntVector(&res->index2, 2);
+	SQX_SetDataInIntVector(&res->index2, 1, 3);
+	SQX_SetDataInIntVector(&res->index2, 2, 4);
+}
+
+/*
+ * Release the SIMCA-QP containers of result.
+ */
+static void cgps_result_clear(struct cgps_result *res)
+{
+	SQX_ClearFloatMatrix(&res->matrix);
+	SQX_ClearIntVector(&res->index1);
+	SQX_ClearIntVector(&res->index2);
+}
+
+/*
+ * Allocate the result matrices reused between requests (one for each result
+ * type). The matrices are empty until first used.
+ */
+static int cgps_result_values_alloc(struct cgps_project *proj, struct cgps_result *res)
+{
+	if(!res->values) {
+		if(!(res->values = calloc(PREDICTED_RESULTS_ALL, sizeof(struct cgps_matrix)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+	}
 	return 0;
 }
 
+/*
+ * Release the result matrices.
+ */
+static void cgps_result_values_free(struct cgps_result *res)
+{
+	int i;
+	
+	if(res->values) {
+		for(i = 0; i < PREDICTED_RESULTS_ALL; ++i) {
+			cgps_matrix_free(&res->values[i]);
+		}
+		free(res->values);
+		res->values = NULL;
+	}
+}
+
 /*
  * Initilize result, the enforcement of a valid project handle is not strictly
  * required, but follow our documented and suggested program flow.
  */
 int cgps_result_init(struct cgps_project *proj, struct cgps_result *res)
 {	
-	if(proj->handle) {
+	if(cgps_project_isopen(proj)) {
 		debug("initilizing result object");
-		
-		SQX_InitIntVector(&res->index1, 2);
-		SQX_SetDataInIntVector(&res->index1, 1, 1);
-		SQX_SetDataInIntVector(&res->index1, 2, 2);
-		
-		SQX_InitIntVector(&res->index2, 2);
-		SQX_SetDataInIntVector(&res->index2, 1, 3);
-		SQX_SetDataInIntVector(&res->index2, 2, 4);
-		
+		cgps_result_init_index(res);
+		res->values = NULL;
 		return 0;
 	}
 	
@@ -979,191 +937,651 @@ int cgps_result_init(struct cgps_project *proj, struct cgps_result *res)
  */
 int cgps_result(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, FILE *out)
 {
-	int numcomp = 0;
-	int isreduced = 0;    /* Contains 1 if the project is a Reduced SIMCA-P project. */
-	int isdatainc = 1;    /* Contains 1 if the primary data set is included in the project. */
-	int isresuinc = 1;    /* Contains 1 if the model residuals is included in the project. */
-
-	res->out = out;
+	const struct cgps_result_sink *sink;
 	
-	/* 
-	 * Check if the project is a Reduced SIMCA-P Project (.rusp) 
-	 */
-	if(!SQX_GetIsReducedUSP(proj->handle, &isreduced)) {
-		logerr("failed check if project is a reduced Simca-Q project (*.rusp) (%s)",
-		       cgps_simcaq_error());
+	if(!(sink = cgps_result_sink_format(proj->opts->format))) {
+		logerr("unknown output format %d", proj->opts->format);
 		return -1;
 	}
-	if(isreduced) {
-		debug("project is a reduced Simca-Q project (*.rusp)");
-		
-		/* 
-		 * Check if the primary data set has been excluded from the project.
-		 */
-		if(!SQX_GetIsPrimaryDataSetIncluded(proj->handle, &isdatainc)) {
-			logerr("failed check if primary data set has been excluded from the project (%s)",
-			       cgps_simcaq_error());
-			return -1;
-		} else {
-			debug("primary data set has been excluded from the project");
+	res->out = out;
+	
+	return cgps_result_to_sink(proj, model, pred, res, sink, res);
+}
+
+/*
+ * Requirements on the model for the results in the getter table.
+ */
+#define CGPS_RESULT_NEED_COMP    0x01   /* model has components */
+#define CGPS_RESULT_NEED_PLS     0x02   /* model is a PLS model */
+#define CGPS_RESULT_NEED_RESUINC 0x04   /* model residuals is included in project */
+
+/*
+ * The result getters in output order.
+ */
+static const struct cgps_result_getter_entry
+{
+	int value;                   /* PREDICTED_XXX */
+	int needs;                   /* CGPS_RESULT_NEED_XXX */
+	cgps_result_getter getter;
+} cgps_result_getter_list[] = {
+	{ PREDICTED_CONTRIB_SSW, 0, cgps_result_contrib_ssw },
+	{ PREDICTED_CONTRIB_SSW_GROUP, 0, cgps_result_contrib_ssw_group },
+	{ PREDICTED_CONTRIB_SMW, 0, cgps_result_contrib_smw },
+	{ PREDICTED_CONTRIB_SMW_GROUP, 0, cgps_result_contrib_smw_group },
+	{ PREDICTED_CONTRIB_DMOD_X, 0, cgps_result_contrib_dmod_x },
+	{ PREDICTED_CONTRIB_DMOD_X_GROUP, 0, cgps_result_contrib_dmod_x_group },
+	
+	{ PREDICTED_DMOD_X_PS, 0, cgps_result_dmod_x_ps },
+	{ PREDICTED_DMOD_X_PS_COMB, 0, cgps_result_dmod_x_ps_comb },
+	{ PREDICTED_PMOD_X_PS, 0, cgps_result_pmod_x_ps },
+	{ PREDICTED_PMOD_X_COMB_PS, 0, cgps_result_pmod_x_comb_ps },
+	
+	{ PREDICTED_TPS, CGPS_RESULT_NEED_COMP, cgps_result_tps },
+	{ PREDICTED_TCV_PS, CGPS_RESULT_NEED_COMP, cgps_result_tcv_ps },
+	{ PREDICTED_TCV_SEPS, CGPS_RESULT_NEED_COMP, cgps_result_tcv_seps },
+	{ PREDICTED_TCV_SED_FPS, CGPS_RESULT_NEED_COMP, cgps_result_tcv_sed_fps },
+	
+	{ PREDICTED_T2_RANGE_PS, 0, cgps_result_t2_range_ps },
+	{ PREDICTED_X_OBS_RES_PS, 0, cgps_result_x_obs_res_ps },
+	{ PREDICTED_X_OBS_PRED_PS, 0, cgps_result_x_obs_pred_ps },
+	{ PREDICTED_X_VAR_PS, 0, cgps_result_x_var_ps },
+	{ PREDICTED_X_VAR_RES_PS, 0, cgps_result_x_var_res_ps },
+	
+	{ PREDICTED_SERR_LPS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_RESUINC, cgps_result_serr_lps },
+	{ PREDICTED_SERR_UPS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_RESUINC, cgps_result_serr_ups },
+	
+	{ PREDICTED_Y_PRED_PS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_COMP, cgps_result_y_pred_ps },
+	{ PREDICTED_Y_PRED_CV_CONF_INT_PS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_COMP, cgps_result_y_pred_cv_conf_int_ps },
+	{ PREDICTED_Y_CV_PS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_COMP, cgps_result_y_cv_ps },
+	{ PREDICTED_Y_CV_SEPS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_COMP, cgps_result_y_cv_seps },
+	{ PREDICTED_Y_OBS_RES_PS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_COMP, cgps_result_y_obs_res_ps },
+	{ PREDICTED_Y_VAR_PS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_COMP, cgps_result_y_var_ps },
+	{ PREDICTED_Y_VAR_RES_PS, CGPS_RESULT_NEED_PLS | CGPS_RESULT_NEED_COMP, cgps_result_y_var_res_ps },
+	
+	{ PREDICTED_RESULTS_NONE, 0, NULL }
+};
+
+/*
+ * Check if getter applies to model. The reason is reported as a warning if
+ * report is non-zero. Returns 0 if the getter should be skipped.
+ */
+static int cgps_result_plan_valid(struct cgps_project *proj, struct cgps_model *model, const struct cgps_result_getter_entry *getter, int report)
+{
+	const struct cgps_result_entry *entry;
+	int ispls;
+	
+	entry = cgps_result_entry_name(getter->value);
+	ispls = model->type == SQX_PLS || model->type == SQX_PLS_Class || model->type == SQX_PLS_DA;
+	
+	if((getter->needs & CGPS_RESULT_NEED_PLS) && !ispls) {
+		if(report) {
+			logwarn("%s is only valid for a PLS model (skipped for model %d)", 
+				entry->desc, model->number);
 		}
-		
-		/* 
-		 * Check if the model residuals has been excluded from the project.
-		 */
-		if(!SQX_GetIsModelResidualsIncluded(proj->handle, &isresuinc)) {
-			logerr("failed check if the model residuals has been excluded from the project (%s)",
-			       cgps_simcaq_error());
-			return -1;
-		} else {
-			debug("model residuals has been excluded from the project");
+		return 0;
+	}
+	if((getter->needs & CGPS_RESULT_NEED_COMP) && model->numcomp <= 0) {
+		if(report) {
+			logwarn("%s is not valid for a zero component model (skipped for model %d)", 
+				entry->desc, model->number);
 		}
+		return 0;
 	}
-	
-	/*
-	 * Get the number of components for this model.
-	 */
-	if(!SQX_GetModelNumberOfComponents(proj->handle, model, &numcomp)) {
-		logerr("failed get number of components for this model (%s)", cgps_simcaq_error());
-		return -1;
-	} else {
-		debug("number of components for this model is %d", numcomp);
+	if((getter->needs & CGPS_RESULT_NEED_RESUINC) && proj->isresuinc != 1) {
+		if(report) {
+			logwarn("%s is only valid if model residuals is still in the project (skipped for model %d)", 
+				entry->desc, model->number);
+		}
+		return 0;
 	}
+	return 1;
+}
+
+/*
+ * Report the results in the bitmask not valid for model. This is done once
+ * when the plan is cached by the model, instead of on each call to 
+ * cgps_result_to_sink().
+ */
+static void cgps_result_plan_report(struct cgps_project *proj, struct cgps_model *model, int result)
+{
+	const struct cgps_result_getter_entry *getter;
 	
-	/*
-	 * Get the model type for this model.
-	 */
-	if(!SQX_GetModelType(proj->handle, model, &res->type)) {
-		logerr("failed get model type for this model (%s)", cgps_simcaq_error());
-		return -1;
-	} else {
-		if(res->type == SQX_UnDefined) {
-			debug("the model type can not be determined");
-		} else {
-#ifndef NDEBUG
-			const char *types[] = {
-				"undefined", "PCA_X", "PCA_Y", "PCA_All", 
-				"PCA_Class", "PSL_Class", "PLS", "PLS_DA"
-			};
-			debug("the model is a %s model", types[res->type]);
-#endif /* NDEBUG */
+	for(getter = cgps_result_getter_list; getter->getter; ++getter) {
+		if(cgps_result_isset(result, getter->value)) {
+			cgps_result_plan_valid(proj, model, getter, 1);
 		}
 	}
-	
-	/*
-	 * Output XML header.
-	 */
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_XML) {
-		fprintf(res->out, "<?xml version=\"1.0\"?>\n");
-		if(proj->opts->verbose) {
-			fprintf(res->out, "<result generator=\"%s\" version=\"%s\">\n", 
-				proj->opts->prog, PACKAGE_VERSION);
-		} else {
-			fprintf(res->out, "<result>\n");
+}
+
+/*
+ * Compile the plan of getters for the results in the bitmask that applies 
+ * to model. Returns NULL on failure.
+ */
+static struct cgps_result_plan * cgps_result_plan_compile(struct cgps_project *proj, struct cgps_model *model, int result)
+{
+	const struct cgps_result_getter_entry *getter;
+	struct cgps_result_plan *plan;
+	
+	if(!(plan = malloc(sizeof(struct cgps_result_plan)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	plan->result = result;
+	plan->numcomp = model->numcomp;
+	plan->count = 0;
+	plan->cached = 0;
+	
+	for(getter = cgps_result_getter_list; getter->getter; ++getter) {
+		if(cgps_result_isset(result, getter->value) &&
+		   cgps_result_plan_valid(proj, model, getter, 0)) {
+			plan->getter[plan->count++] = getter->getter;
 		}
 	}
 	
-	/*
-	 * See which result to present.
-	 */
-	if(cgps_result_isset(proj->opts->result, PREDICTED_CONTRIB_SSW)) {
-		cgps_result_contrib_ssw(proj, pred, res, numcomp);
-	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_CONTRIB_SSW_GROUP)) {
-		cgps_result_contrib_ssw_group(proj, pred, res, numcomp);
-	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_CONTRIB_SMW)) {
-		cgps_result_contrib_smw(proj, pred, res);
-	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_CONTRIB_SMW_GROUP)) {
-		cgps_result_contrib_smw_group(proj, pred, res);
+	debug("compiled result plan for model %d (%d results)", model->number, plan->count);
+	return plan;
+}
+
+/*
+ * Get the result plan of model for the result bitmask, compiling it on first
+ * use. The plans are cached in a small table in the model, a new plan is 
+ * published in a free slot with compare and swap. Cached plans are never 
+ * replaced (another thread might be using them) and are released with the 
+ * model. If the table is full, an uncached plan is returned that must be 
+ * released by the caller with cgps_result_plan_release(). The skipped 
+ * results are only reported when a plan is cached, not for uncached plans.
+ */
+static struct cgps_result_plan * cgps_result_plan_get(struct cgps_project *proj, struct cgps_model *model, int result)
+{
+	struct cgps_result_plan *plan, *next = NULL;
+	int i;
+	
+	for(i = 0; i < CGPS_RESULT_PLANS; ++i) {
+		plan = model->plan[i];
+		if(!plan) {
+			if(!next && !(next = cgps_result_plan_compile(proj, model, result))) {
+				return NULL;
+			}
+			/*
+			 * Mark the plan as cached before publishing it, as other
+			 * threads may use (and release) it as soon as it's visible.
+			 */
+			next->cached = 1;
+			if(__sync_bool_compare_and_swap(&model->plan[i], NULL, next)) {
+				cgps_result_plan_report(proj, model, result);
+				return next;
+			}
+			next->cached = 0;
+			plan = model->plan[i];
+		}
+		if(plan->result == result) {
+			free(next);
+			return plan;
+		}
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_CONTRIB_DMOD_X)) {
-		cgps_result_contrib_dmod_x(proj, pred, res, numcomp);
+	
+	if(!next && !(next = cgps_result_plan_compile(proj, model, result))) {
+		return NULL;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_CONTRIB_DMOD_X_GROUP)) {
-		cgps_result_contrib_dmod_x_group(proj, pred, res, numcomp);
+	debug("result plan cache of model %d is full", model->number);
+	return next;
+}
+
+/*
+ * Release plan if not cached by the model.
+ */
+static void cgps_result_plan_release(struct cgps_result_plan *plan)
+{
+	if(!plan->cached) {
+		free(plan);
 	}
+}
+
+/*
+ * Release the result plans of model.
+ */
+void cgps_result_plan_free(struct cgps_model *model)
+{
+	int i;
 	
-	if(cgps_result_isset(proj->opts->result, PREDICTED_DMOD_X_PS)) {
-		cgps_result_dmod_x_ps(proj, pred, res);
+	for(i = 0; i < CGPS_RESULT_PLANS; ++i) {
+		free(model->plan[i]);
+		model->plan[i] = NULL;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_DMOD_X_PS_COMB)) {
-		cgps_result_dmod_x_ps_comb(proj, pred, res);
+}
+
+/*
+ * Recording of sink calls for being replayed to another sink later. The 
+ * record is used as data for cgps_result_record_sink and owns copies of the
+ * matrix values. This lets the output be produced on one thread and passed 
+ * to the real sink on another (see below and stream.c).
+ */
+
+#define CGPS_RESULT_EVENT_BEGIN  1   /* begin_result() */
+#define CGPS_RESULT_EVENT_MATRIX 2   /* matrix() */
+#define CGPS_RESULT_EVENT_END    3   /* end_result() */
+#define CGPS_RESULT_EVENT_BEGIN_DOCUMENT 4   /* begin_document() */
+#define CGPS_RESULT_EVENT_END_DOCUMENT   5   /* end_document() */
+
+struct cgps_result_event
+{
+	int type;                               /* CGPS_RESULT_EVENT_XXX */
+	const struct cgps_result_entry *entry;  /* the result (NULL for document) */
+	int model;                              /* model number (document) */
+	struct cgps_matrix values;              /* copy of matrix values */
+};
+
+/*
+ * Append sink call to record.
+ */
+static struct cgps_result_event * cgps_result_record_event(struct cgps_project *proj, struct cgps_result_record *record, int type, const struct cgps_result_entry *entry)
+{
+	struct cgps_result_event *event;
+	
+	if(record->nevents == record->size) {
+		int size = record->size ? 2 * record->size : 4;
+		if(!(event = realloc(record->event, size * sizeof(struct cgps_result_event)))) {
+			logerr("failed alloc memory");
+			record->failed = 1;
+			return NULL;
+		}
+		memset(event + record->size, 0, (size - record->size) * sizeof(struct cgps_result_event));
+		record->event = event;
+		record->size = size;
+	}
+	event = &record->event[record->nevents++];
+	event->type = type;
+	event->entry = entry;
+	event->model = 0;
+	return event;
+}
+
+static int cgps_result_record_begin_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result_event *event;
+	
+	if(!(event = cgps_result_record_event(proj, data, CGPS_RESULT_EVENT_BEGIN_DOCUMENT, NULL))) {
+		return -1;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_PMOD_X_PS)) {
-		cgps_result_pmod_x_ps(proj, pred, res);
+	event->model = model;
+	return 0;
+}
+
+static int cgps_result_record_begin(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	return cgps_result_record_event(proj, data, CGPS_RESULT_EVENT_BEGIN, entry) ? 0 : -1;
+}
+
+static int cgps_result_record_matrix(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry, const float *values, int rows, int cols)
+{
+	struct cgps_result_event *event;
+	
+	if(!(event = cgps_result_record_event(proj, data, CGPS_RESULT_EVENT_MATRIX, entry))) {
+		return -1;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_PMOD_X_COMB_PS)) {
-		cgps_result_pmod_x_comb_ps(proj, pred, res);
+	if(cgps_matrix_resize(&event->values, rows, cols) < 0) {
+		logerr("failed alloc memory");
+		((struct cgps_result_record *)data)->failed = 1;
+		return -1;
 	}
+	memcpy(event->values.data, values, (size_t)rows * cols * sizeof(float));
+	return 0;
+}
 
-	/*
-	 * These four function requires that numcomp > 0
-	 */
-	if(cgps_result_isset(proj->opts->result, PREDICTED_TPS)) {
-		cgps_result_tps(proj, pred, res, numcomp);
-	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_TCV_PS)) {
-		cgps_result_tcv_ps(proj, pred, res, numcomp);
+static int cgps_result_record_end(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	return cgps_result_record_event(proj, data, CGPS_RESULT_EVENT_END, entry) ? 0 : -1;
+}
+
+static int cgps_result_record_end_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result_event *event;
+	
+	if(!(event = cgps_result_record_event(proj, data, CGPS_RESULT_EVENT_END_DOCUMENT, NULL))) {
+		return -1;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_TCV_SEPS)) {
-		cgps_result_tcv_seps(proj, pred, res, numcomp);
+	event->model = model;
+	return 0;
+}
+
+const struct cgps_result_sink cgps_result_record_sink = {
+	cgps_result_record_begin_document, 
+	cgps_result_record_begin, 
+	cgps_result_record_matrix, 
+	cgps_result_record_end, 
+	cgps_result_record_end_document
+};
+
+/*
+ * Pass the sink calls in record to sink. Returns -1 if any call failed or
+ * the recording was incomplete.
+ */
+int cgps_result_replay(struct cgps_project *proj, struct cgps_result_record *record, const struct cgps_result_sink *sink, void *data)
+{
+	struct cgps_result_event *event;
+	int i, status = 0;
+	
+	for(i = 0; i < record->nevents; ++i) {
+		event = &record->event[i];
+		switch(event->type) {
+		case CGPS_RESULT_EVENT_BEGIN_DOCUMENT:
+			if(sink->begin_document && sink->begin_document(proj, data, event->model) < 0) {
+				logerr("result sink failed to begin model %d", event->model);
+				status = -1;
+			}
+			break;
+		case CGPS_RESULT_EVENT_BEGIN:
+			if(sink->begin_result && sink->begin_result(proj, data, event->entry) < 0) {
+				logerr("result sink failed to begin %s", event->entry->desc);
+				status = -1;
+			}
+			break;
+		case CGPS_RESULT_EVENT_MATRIX:
+			if(sink->matrix && sink->matrix(proj, data, event->entry, event->values.data, event->values.rows, event->values.cols) < 0) {
+				logerr("result sink failed for %s", event->entry->desc);
+				status = -1;
+			}
+			break;
+		case CGPS_RESULT_EVENT_END:
+			if(sink->end_result && sink->end_result(proj, data, event->entry) < 0) {
+				logerr("result sink failed to end %s", event->entry->desc);
+				status = -1;
+			}
+			break;
+		case CGPS_RESULT_EVENT_END_DOCUMENT:
+			if(sink->end_document && sink->end_document(proj, data, event->model) < 0) {
+				logerr("result sink failed to end model %d", event->model);
+				status = -1;
+			}
+			break;
+		}
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_TCV_SED_FPS)) {
-		cgps_result_tcv_sed_fps(proj, pred, res, numcomp);
+	if(record->failed) {
+		logerr("failed record result output (out of memory)");
+		status = -1;
 	}
+	return status;
+}
+
+/*
+ * Discard the recorded sink calls. The event list and the memory of its 
+ * matrices are kept for reuse.
+ */
+void cgps_result_record_reset(struct cgps_result_record *record)
+{
+	record->nevents = 0;
+	record->failed = 0;
+}
+
+/*
+ * Release memory used by record.
+ */
+void cgps_result_record_free(struct cgps_result_record *record)
+{
+	int i;
 	
-	if(cgps_result_isset(proj->opts->result, PREDICTED_T2_RANGE_PS)) {
-		cgps_result_t2_range_ps(proj, pred, res, numcomp);
+	for(i = 0; i < record->size; ++i) {
+		cgps_matrix_free(&record->event[i].values);
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_X_OBS_RES_PS)) {
-		cgps_result_x_obs_res_ps(proj, pred, res, numcomp);
+	cgps_result_record_reset(record);
+	if(record->event) {
+		free(record->event);
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_X_OBS_PRED_PS)) {
-		cgps_result_x_obs_pred_ps(proj, pred, res, numcomp);
-	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_X_VAR_PS)) {
-		cgps_result_x_var_ps(proj, pred, res);
+	record->event = NULL;
+	record->size = 0;
+}
+
+/*
+ * Extraction of results in parallel. Each getter in the plan is run as a job
+ * on a worker thread with a private cgps_result, whose sink records the 
+ * output. The calling thread replays the recorded output to the real sink in
+ * plan order as soon as each job is done, so the sink (that might not be
+ * thread-safe) is only called from one thread while the remaining getters
+ * are running. This requires that SIMCA-QP allows concurrent getters on the
+ * same prediction handle.
+ */
+
+struct cgps_result_job
+{
+	struct cgps_result res;              /* private result object */
+	struct cgps_result_record record;    /* recorded sink calls */
+	int status;                          /* return value of getter */
+	int done;                            /* getter has finished */
+};
+
+struct cgps_result_batch
+{
+	struct cgps_predict *pred;         /* the prediction */
+	struct cgps_result_plan *plan;     /* getters to run */
+	struct cgps_result_job *job;       /* one job for each getter */
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_t lock;              /* guards done */
+	pthread_cond_t cond;               /* signals done */
+#endif
+};
+
+/*
+ * Run getter for job on worker thread.
+ */
+static int cgps_result_job_run(struct cgps_project *proj, void *arg, int index)
+{
+	struct cgps_result_batch *batch = (struct cgps_result_batch *)arg;
+	struct cgps_result_job *job = &batch->job[index];
+	int status;
+	
+	status = batch->plan->getter[index](proj, batch->pred, &job->res, batch->plan->numcomp);
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&batch->lock);
+	job->status = status;
+	job->done = 1;
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->lock);
+#else
+	job->status = status;
+	job->done = 1;
+#endif
+	return status;
+}
+
+/*
+ * Wait for job to finish. The calling thread runs pending jobs while waiting.
+ */
+static void cgps_result_job_wait(struct cgps_result_batch *batch, struct cgps_worker *worker, struct cgps_result_job *job)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&batch->lock);
+	while(!job->done) {
+		pthread_mutex_unlock(&batch->lock);
+		if(!cgps_worker_help(worker)) {
+			pthread_mutex_lock(&batch->lock);
+			while(!job->done) {
+				pthread_cond_wait(&batch->cond, &batch->lock);
+			}
+			break;
+		}
+		pthread_mutex_lock(&batch->lock);
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_X_VAR_RES_PS)) {
-		cgps_result_x_var_res_ps(proj, pred, res, numcomp);
+	pthread_mutex_unlock(&batch->lock);
+#else
+	while(!job->done && cgps_worker_help(worker)) {
+		;
 	}
+#endif
+}
 
-	if(cgps_result_isset(proj->opts->result, PREDICTED_SERR_LPS)) {
-		cgps_result_serr_lps(proj, pred, res, numcomp, isresuinc);
+/*
+ * Release recorded output and result object of job.
+ */
+static void cgps_result_job_free(struct cgps_result_job *job)
+{
+	cgps_result_record_free(&job->record);
+	cgps_result_clear(&job->res);
+}
+
+/*
+ * Get number of threads for extracting results. Running getters concurrently
+ * on the same prediction handle is not verified with SIMCA-QP, so this is
+ * only done if explicit requested (CGPS_THREADING_AUTO is not honored).
+ */
+static int cgps_result_threads(struct cgps_project *proj)
+{
+	if(proj->opts->rthreads > 0) {
+		return proj->opts->rthreads;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_SERR_UPS)) {
-		cgps_result_serr_ups(proj, pred, res, numcomp, isresuinc);
+	return 1;
+}
+
+/*
+ * Setup the jobs for running the getters in plan and start threads - 1 
+ * worker threads. Returns NULL on failure.
+ */
+static struct cgps_worker * cgps_result_batch_start(struct cgps_project *proj, struct cgps_result_batch *batch, struct cgps_predict *pred, struct cgps_result *res, struct cgps_result_plan *plan, int threads)
+{
+	struct cgps_worker *worker;
+	int i;
+	
+	batch->pred = pred;
+	batch->plan = plan;
+	if(!(batch->job = calloc(plan->count, sizeof(struct cgps_result_job)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	for(i = 0; i < plan->count; ++i) {
+		batch->job[i].res.type = res->type;
+		batch->job[i].res.sink = &cgps_result_record_sink;
+		batch->job[i].res.data = &batch->job[i].record;
+		batch->job[i].res.values = res->values;
+		cgps_result_init_index(&batch->job[i].res);
+	}
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->cond, NULL);
+#endif
+	
+	if(!(worker = cgps_worker_start(proj, threads - 1, plan->count, cgps_result_job_run, batch))) {
+		for(i = 0; i < plan->count; ++i) {
+			cgps_result_job_free(&batch->job[i]);
+		}
+		free(batch->job);
+#ifdef HAVE_LIBPTHREAD
+		pthread_cond_destroy(&batch->cond);
+		pthread_mutex_destroy(&batch->lock);
+#endif
 	}
+	return worker;
+}
 
-	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_PRED_PS)) {
-		cgps_result_y_pred_ps(proj, pred, res, numcomp);
+/*
+ * Emit the output of all jobs in plan order to the sink of res (discarded if
+ * res is NULL) and release the batch. Returns -1 if any getter or the sink
+ * failed.
+ */
+static int cgps_result_batch_finish(struct cgps_project *proj, struct cgps_result_batch *batch, struct cgps_worker *worker, struct cgps_result *res)
+{
+	int i, status = 0;
+	
+	for(i = 0; res && i < batch->plan->count; ++i) {
+		cgps_result_job_wait(batch, worker, &batch->job[i]);
+		if(batch->job[i].status < 0) {
+			status = -1;
+		}
+		if(cgps_result_replay(proj, &batch->job[i].record, res->sink, res->data) < 0) {
+			status = -1;
+		}
+	}
+	cgps_worker_join(worker);
+	
+	for(i = 0; i < batch->plan->count; ++i) {
+		cgps_result_job_free(&batch->job[i]);
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_PRED_CV_CONF_INT_PS)) {
-		cgps_result_y_pred_cv_conf_int_ps(proj, pred, res, numcomp);
+	free(batch->job);
+#ifdef HAVE_LIBPTHREAD
+	pthread_cond_destroy(&batch->cond);
+	pthread_mutex_destroy(&batch->lock);
+#endif
+	return status;
+}
+
+/*
+ * Get result using the sink callbacks. All requested results are passed to
+ * the sink even if one of them fails, but -1 is returned in that case.
+ */
+int cgps_result_to_sink(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, const struct cgps_result_sink *sink, void *data)
+{
+	struct cgps_model *desc;
+	struct cgps_result_plan *plan;
+	struct cgps_result_batch batch;
+	struct cgps_worker *worker = NULL;
+	int i, threads, failed = 0, status = -1;
+
+	res->sink = sink;
+	res->data = data;
+	
+	/*
+	 * The model metadata is cached in the project when its loaded.
+	 */
+	if(!(desc = cgps_project_model_number(proj, model))) {
+		logerr("failed get metadata for model %d", model);
+		return -1;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_CV_PS)) {
-		cgps_result_y_cv_ps(proj, pred, res, numcomp);
+	if(!(plan = cgps_result_plan_get(proj, desc, proj->opts->result))) {
+		logerr("failed get result plan for model %d", model);
+		return -1;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_CV_SEPS)) {
-		cgps_result_y_cv_seps(proj, pred, res, numcomp);
+	res->type = desc->type;
+	
+	if(cgps_result_values_alloc(proj, res) < 0) {
+		goto done;
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_OBS_RES_PS)) {
-		cgps_result_y_obs_res_ps(proj, pred, res, numcomp);
+	
+	/*
+	 * Start extracting the results before the document is begun.
+	 */
+	threads = cgps_result_threads(proj);
+	if(threads > 1 && plan->count > 1) {
+		if(!(worker = cgps_result_batch_start(proj, &batch, pred, res, plan, threads))) {
+			goto done;
+		}
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_VAR_PS)) {
-		cgps_result_y_var_ps(proj, pred, res, numcomp);
+	
+	if(sink->begin_document) {
+		if(sink->begin_document(proj, data, model) < 0) {
+			logerr("result sink failed to begin model %d", model);
+			if(worker) {
+				cgps_result_batch_finish(proj, &batch, worker, NULL);
+			}
+			goto done;
+		}
 	}
-	if(cgps_result_isset(proj->opts->result, PREDICTED_Y_VAR_RES_PS)) {
-		cgps_result_y_var_res_ps(proj, pred, res, numcomp);
+	
+	if(worker) {
+		if(cgps_result_batch_finish(proj, &batch, worker, res) < 0) {
+			failed = 1;
+		}
+	} else {
+		for(i = 0; i < plan->count; ++i) {
+			if(plan->getter[i](proj, pred, res, plan->numcomp) < 0) {
+				failed = 1;
+			}
+		}
 	}
 
-	if(proj->opts->format == CGPS_OUTPUT_FORMAT_XML) {
-		fprintf(res->out, "</result>\n");
+	if(sink->end_document) {
+		if(sink->end_document(proj, data, model) < 0) {
+			logerr("result sink failed to end model %d", model);
+			goto done;
+		}
+	}
+	if(failed) {
+		logerr("failed get results for model %d", model);
+	} else {
+		status = 0;
 	}
 	
-	return 0;
+ done:
+	cgps_result_plan_release(plan);
+	return status;
 }
 
 /*
@@ -1171,13 +1589,12 @@ int cgps_result(struct cgps_project *proj, int model, struct cgps_predict *pred,
  */
 void cgps_result_cleanup(struct cgps_project *proj, struct cgps_result *res)
 {
-	if(proj->handle) {
+	if(cgps_project_isopen(proj)) {
 		debug("cleaning up result object");
 	} else {
 		logwarn("no valid project handle");
 	}
 	
-	SQX_ClearFloatMatrix(&res->matrix);
-	SQX_ClearIntVector(&res->index1);
-	SQX_ClearIntVector(&res->index2);
+	cgps_result_clear(res);
+	cgps_result_values_free(res);
 }
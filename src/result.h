@@ -1,16 +1,16 @@
 const struct cgps_result_entry * cgps_result_entry_name(int value);
-void cgps_result_print_header(struct cgps_project *proj, FILE *fs, const char *title, const char *name);
-void cgps_result_print_footer(struct cgps_project *proj, FILE *fs);
+int cgps_result_print_header(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry);
+int cgps_result_print_footer(struct cgps_project *proj, struct cgps_result *res, const struct cgps_result_entry *entry);
 int cgps_result_contrib_ssw(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_contrib_ssw_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
-int cgps_result_contrib_smw(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res);
-int cgps_result_contrib_smw_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res);
+int cgps_result_contrib_smw(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
+int cgps_result_contrib_smw_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_contrib_dmod_x(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_contrib_dmod_x_group(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
-int cgps_result_dmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res);
-int cgps_result_dmod_x_ps_comb(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res);
-int cgps_result_pmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res);
-int cgps_result_pmod_x_comb_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res);
+int cgps_result_dmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
+int cgps_result_dmod_x_ps_comb(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
+int cgps_result_pmod_x_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
+int cgps_result_pmod_x_comb_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_tps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_tcv_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_tcv_seps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
@@ -18,10 +18,10 @@ int cgps_result_tcv_sed_fps(struct cgps_project *proj, struct cgps_predict *pred
 int cgps_result_t2_range_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_x_obs_res_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_x_obs_pred_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
-int cgps_result_x_var_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res);
+int cgps_result_x_var_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_x_var_res_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
-int cgps_result_serr_lps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp, int isresuinc);
-int cgps_result_serr_ups(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp, int isresuinc);
+int cgps_result_serr_lps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
+int cgps_result_serr_ups(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_y_pred_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_y_pred_cv_conf_int_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_y_cv_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
@@ -31,4 +31,5 @@ int cgps_result_y_var_ps(struct cgps_project *proj, struct cgps_predict *pred, s
 int cgps_result_y_var_res_ps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
 int cgps_result_init(struct cgps_project *proj, struct cgps_result *res);
 int cgps_result(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, FILE *out);
+int cgps_result_to_sink(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, const struct cgps_result_sink *sink, void *data);
 void cgps_result_cleanup(struct cgps_project *proj, struct cgps_result *res);
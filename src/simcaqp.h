@@ -124,11 +124,203 @@ const char * cgps_simcaq_error(void);
 /*
  * Loads client data:
  */
-int cgps_predict_get_raw_data(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *names);
-int cgps_predict_get_lag_parents(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *parents);
-int cgps_predict_get_qual_data(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *names);
-int cgps_predict_get_qual_data_lagged(struct cgps_project *proj, int model, struct cgps_predict *pred, SQX_StringVector *names);
+int cgps_predict_prepare_model(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred);
+
+int cgps_predict_get_raw_data(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred);
+int cgps_predict_get_lag_parents(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred);
+int cgps_predict_get_qual_data(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred);
+int cgps_predict_get_qual_data_lagged(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred);
+int cgps_predict_input_map(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred);
+void cgps_predict_input_free(struct cgps_predict *pred);
+
+/*
+ * Value of model variable var (0-based) for observation row in the caller 
+ * supplied input (see cgps_predict_set_input()).
+ */
+#define cgps_predict_input(pred, row, var) \
+	((pred)->batch[(size_t)(row) * (pred)->stride + ((pred)->colmap ? (pred)->colmap[var] : (var))])
+
+/*
+ * Load state of model descriptors:
+ */
+#define CGPS_MODEL_UNLOADED 0      /* only index and number is set */
+#define CGPS_MODEL_LOADING  1      /* being loaded by another thread */
+#define CGPS_MODEL_LOADED   2      /* metadata and native parameters loaded */
+#define CGPS_MODEL_FAILED   3      /* failed load model */
+
+/*
+ * Lookup model descriptors, the model is loaded on first use (returns NULL 
+ * if not found or failed load):
+ */
+struct cgps_model * cgps_project_model_index(struct cgps_project *proj, int index);
+struct cgps_model * cgps_project_model_number(struct cgps_project *proj, int number);
 
 int cgps_detect_cpus(struct cgps_project *proj);
 
+/*
+ * Plain float matrix (column-major) with aligned storage:
+ */
+#define CGPS_MATRIX_ALIGN 64
+
+struct cgps_matrix
+{
+	float *data;               /* values, column by column */
+	int rows;                  /* number of rows */
+	int cols;                  /* number of columns */
+	size_t size;               /* allocated number of values */
+};
+
+#define cgps_matrix_get(m, row, col) ((m)->data[(size_t)(col) * (m)->rows + (row)])
+
+int cgps_matrix_alloc(struct cgps_matrix *matrix, int rows, int cols);
+int cgps_matrix_resize(struct cgps_matrix *matrix, int rows, int cols);
+void cgps_matrix_free(struct cgps_matrix *matrix);
+int cgps_matrix_extract(struct cgps_project *proj, SQX_FloatMatrix *src, struct cgps_matrix *dest);
+int cgps_matrix_read(struct cgps_project *proj, SQX_FloatMatrix *src, float *data);
+
+/*
+ * Arena for the scratch memory of a prediction (see arena.c):
+ */
+#define CGPS_ARENA_ALIGN CGPS_MATRIX_ALIGN
+
+void * cgps_arena_alloc(struct cgps_arena *arena, size_t size);
+int cgps_arena_reserve(struct cgps_arena *arena, size_t size);
+void cgps_arena_keep(struct cgps_arena *arena);
+void cgps_arena_reset(struct cgps_arena *arena);
+void cgps_arena_clear(struct cgps_arena *arena);
+void cgps_arena_free(struct cgps_arena *arena);
+
+/*
+ * Format float as text (digits == 0 for shortest round trip):
+ */
+#define CGPS_FORMAT_FLOAT_MAX 32
+
+int cgps_format_float(char *buff, float f, int digits);
+
+/*
+ * Built-in result sink for output format (see sink.c).
+ */
+const struct cgps_result_sink * cgps_result_sink_format(int format);
+
+/*
+ * Numeric kernels for the native engine (see kernel.c). The active variant
+ * is selected for the CPU when the library is loaded.
+ */
+struct cgps_kernel
+{
+	int variant;        /* CGPS_KERNEL_XXX */
+	const char *name;   /* instruction set name */
+	void (*scores)(const float *x, int n, int k, const float *w, const float *t0, int a, float *t);
+	void (*residuals)(const float *x, const float *t, int n, int k, int a, const float *q, const float *m, float *e);
+	void (*sumsq)(const float *v, int n, const float *g, int c, float *s);
+	void (*transpose)(const float *src, int rows, int cols, float *dest);
+};
+
+extern const struct cgps_kernel *cgps_kernel;
+
+int cgps_kernel_select(int variant);
+
+/*
+ * Model parameters for the native prediction engine (see native.c). The
+ * matrices are stored column by column.
+ */
+struct cgps_native
+{
+	int nvars;          /* number of quantitative variables (K) */
+	int ncomp;          /* number of components (A) */
+	float *weights;     /* score weights (K x A) */
+	float *offset;      /* score of the origin (A) */
+	float *t2scale;     /* T2 weights for squared scores (A) */
+	float *loadings;    /* reconstruction loadings (A x K) */
+	float *center;      /* reconstruction of zero scores (K) */
+	float *dmodx;       /* DModX weights for squared residuals (K) */
+	float *contrib;     /* DModX contribution weights for residuals (K) */
+	float *coefs;       /* regression coefficients for predicted Y (K x M) */
+	float *yoffset;     /* predicted Y of the origin (M) */
+	int nyvars;         /* number of Y variables (M) */
+	double df1;         /* degrees of freedom for PModX */
+	double df2;         /* degrees of freedom for PModX (0 if missing) */
+	int tobs;           /* observations are rows in SIMCA-QP scores */
+	int t2obs;          /* observations are rows in SIMCA-QP T2 */
+	int robs;           /* observations are rows in SIMCA-QP residuals */
+	int dobs;           /* observations are rows in SIMCA-QP DModX */
+	int pobs;           /* observations are rows in SIMCA-QP PModX */
+	int cobs;           /* observation is row in SIMCA-QP contributions */
+	int yobs;           /* observations are rows in SIMCA-QP predicted Y */
+	int mapped;         /* parameters points into a mapped model file */
+};
+
+int cgps_native_load(struct cgps_project *proj, struct cgps_model *model);
+void cgps_native_free(struct cgps_model *model);
+int cgps_native_usable(struct cgps_project *proj, struct cgps_model *model);
+int cgps_native_predict(struct cgps_project *proj, struct cgps_model *model, struct cgps_predict *pred);
+void cgps_native_release(struct cgps_predict *pred);
+int cgps_native_tps(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest);
+int cgps_native_t2_range(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest);
+int cgps_native_x_obs_res(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest);
+int cgps_native_dmod_x(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest);
+int cgps_native_pmod_x(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest);
+int cgps_native_contrib_dmod_x(struct cgps_project *proj, struct cgps_predict *pred, int obs, struct cgps_matrix *dest);
+int cgps_native_y_pred(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_matrix *dest);
+
+/*
+ * Result getters compiled for a model and result bitmask (see result.c).
+ */
+typedef int (*cgps_result_getter)(struct cgps_project *proj, struct cgps_predict *pred, struct cgps_result *res, int numcomp);
+
+struct cgps_result_plan
+{
+	int result;                      /* bitmask of results compiled for */
+	int numcomp;                     /* number of components */
+	int count;                       /* number of getters */
+	cgps_result_getter getter[PREDICTED_RESULTS_ALL];  /* getters in output order */
+	int cached;                      /* plan is owned by the model */
+};
+
+void cgps_result_plan_free(struct cgps_model *model);
+
+/*
+ * Sink calls recorded by cgps_result_record_sink (with the record as data)
+ * for being replayed to another sink. The record is zero initialized.
+ */
+struct cgps_result_record
+{
+	struct cgps_result_event *event;   /* recorded sink calls */
+	int nevents;                       /* number of recorded calls */
+	int size;                          /* allocated size of event */
+	int failed;                        /* recording failed */
+};
+
+extern const struct cgps_result_sink cgps_result_record_sink;
+
+int cgps_result_replay(struct cgps_project *proj, struct cgps_result_record *record, const struct cgps_result_sink *sink, void *data);
+void cgps_result_record_reset(struct cgps_result_record *record);
+void cgps_result_record_free(struct cgps_result_record *record);
+
+/*
+ * Memory mapped model files (see mapped.c).
+ */
+int cgps_mapped_open(struct cgps_project *proj, const char *path);
+void cgps_mapped_close(struct cgps_project *proj);
+
+/*
+ * True if project has a project handle or mapped model file.
+ */
+#define cgps_project_isopen(proj) ((proj)->handle || (proj)->mapped)
+
+/*
+ * Run independent jobs on a pool of worker threads:
+ */
+typedef int (*cgps_worker_func)(struct cgps_project *proj, void *arg, int job);
+
+int cgps_worker_threads(struct cgps_project *proj);
+int cgps_worker_run(struct cgps_project *proj, int threads, int jobs, cgps_worker_func func, void *arg);
+
+/*
+ * Run jobs in the background while the calling thread does other work:
+ */
+struct cgps_worker * cgps_worker_start(struct cgps_project *proj, int threads, int jobs, cgps_worker_func func, void *arg);
+int cgps_worker_help(struct cgps_worker *worker);
+int cgps_worker_join(struct cgps_worker *worker);
+
 #endif /* __SIMCAQP_H__ */
@@ -0,0 +1,420 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * The built-in result sinks writing plain text, XML, binary or JSON output 
+ * to the FILE stream of the cgps_result struct (passed as sink data).
+ */
+
+/*
+ * Binary output format. All integers and floats are written as 32-bit little 
+ * endian values (independent of the host byte order). The stream for each 
+ * call to cgps_result() is:
+ * 
+ *   "CGPS" <version> <model>             (document header)
+ *   <id> <rows> <cols> <rows * cols>     (one frame per result matrix)
+ *   0 0 0                                (document trailer)
+ * 
+ * The id is the PREDICTED_XXX value of the result and the float values are 
+ * stored column by column (same order as the plain and XML formats).
+ */
+#define CGPS_BINARY_MAGIC   "CGPS"
+#define CGPS_BINARY_VERSION 1
+#define CGPS_BINARY_BUFFER  256      /* floats per write */
+
+/*
+ * Store value as 32-bit little endian in buff.
+ */
+static void cgps_sink_pack_uint32(unsigned char *buff, unsigned long value)
+{
+	buff[0] = (unsigned char)(value & 0xff);
+	buff[1] = (unsigned char)((value >> 8) & 0xff);
+	buff[2] = (unsigned char)((value >> 16) & 0xff);
+	buff[3] = (unsigned char)((value >> 24) & 0xff);
+}
+
+/*
+ * Store float f as 32-bit little endian in buff.
+ */
+static void cgps_sink_pack_float(unsigned char *buff, float f)
+{
+	unsigned int u;
+	
+	memcpy(&u, &f, sizeof(u));
+	cgps_sink_pack_uint32(buff, u);
+}
+
+/*
+ * Write header of an binary frame. Returns -1 on failure.
+ */
+static int cgps_sink_binary_frame(FILE *out, int id, int rows, int cols)
+{
+	unsigned char buff[12];
+	
+	cgps_sink_pack_uint32(buff, id);
+	cgps_sink_pack_uint32(buff + 4, rows);
+	cgps_sink_pack_uint32(buff + 8, cols);
+	return fwrite(buff, 1, sizeof(buff), out) == sizeof(buff) ? 0 : -1;
+}
+
+/*
+ * Check the error indicator of the output stream. The text sinks write using
+ * stdio, so the result of each fprintf() is not checked. Returns -1 if any
+ * write has failed (i.e. disk full or closed pipe).
+ */
+static int cgps_sink_status(struct cgps_project *proj, FILE *out)
+{
+	if(ferror(out)) {
+		logerr("failed write result output");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Flush output at end of document, so that write errors are detected before
+ * the result is reported as done. Returns -1 on failure.
+ */
+static int cgps_sink_flush(struct cgps_project *proj, FILE *out)
+{
+	if(fflush(out) == EOF) {
+		logerr("failed flush result output");
+		return -1;
+	}
+	return cgps_sink_status(proj, out);
+}
+
+/*
+ * Plain text output (tab separated table).
+ */
+static int cgps_sink_plain_begin_result(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	struct cgps_result *res = data;
+	
+	if(proj->opts->verbose) {
+		fprintf(res->out, "# ----------------------------------------------\n");
+		fprintf(res->out, "# %s (%s):\n", entry->desc, entry->name);
+		fprintf(res->out, "# ----------------------------------------------\n");
+	}
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_plain_matrix(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry, const float *values, int rows, int cols)
+{
+	struct cgps_result *res = data;
+	int i, j;
+	
+	(void)entry;
+	
+	for(i = 0; i < cols; ++i) {
+		for(j = 0; j < rows; ++j) {
+			fprintf(res->out, "%f\t", *values++);
+		}
+		fprintf(res->out, "\n");
+	}
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_plain_end_result(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	struct cgps_result *res = data;
+	
+	(void)entry;
+	
+	fprintf(res->out, "\n");
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_plain_end_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result *res = data;
+	
+	(void)model;
+	
+	return cgps_sink_flush(proj, res->out);
+}
+
+/*
+ * XML output.
+ */
+static int cgps_sink_xml_begin_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result *res = data;
+	
+	(void)model;
+	
+	fprintf(res->out, "<?xml version=\"1.0\"?>\n");
+	if(proj->opts->verbose) {
+		fprintf(res->out, "<result generator=\"%s\" version=\"%s\">\n", 
+			proj->opts->prog, PACKAGE_VERSION);
+	} else {
+		fprintf(res->out, "<result>\n");
+	}
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_xml_begin_result(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	struct cgps_result *res = data;
+	
+	if(proj->opts->verbose) {
+		fprintf(res->out, "  <prediction name=\"%s\" desc=\"%s\">\n", entry->name, entry->desc);
+	} else {
+		fprintf(res->out, "  <prediction name=\"%s\">\n", entry->name);
+	}
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_xml_matrix(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry, const float *values, int rows, int cols)
+{
+	struct cgps_result *res = data;
+	int i, j;
+	
+	(void)entry;
+	
+	for(i = 0; i < cols; ++i) {
+		fprintf(res->out, "    <values num=\"%d\">\n      ", rows);
+		for(j = 0; j < rows; ++j) {
+			fprintf(res->out, "<value>%f</value>", *values++);
+		}
+		fprintf(res->out, "\n    </values>\n");
+	}
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_xml_end_result(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	struct cgps_result *res = data;
+	
+	(void)entry;
+	
+	fprintf(res->out, "  </prediction>\n");
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_xml_end_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result *res = data;
+	
+	(void)model;
+	
+	fprintf(res->out, "</result>\n");
+	return cgps_sink_flush(proj, res->out);
+}
+
+/*
+ * Binary output (see above).
+ */
+static int cgps_sink_binary_begin_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result *res = data;
+	unsigned char buff[8];
+		
+	cgps_sink_pack_uint32(buff, CGPS_BINARY_VERSION);
+	cgps_sink_pack_uint32(buff + 4, model);
+	if(fwrite(CGPS_BINARY_MAGIC, 1, 4, res->out) != 4 ||
+	   fwrite(buff, 1, sizeof(buff), res->out) != sizeof(buff)) {
+		logerr("failed write result output");
+		return -1;
+	}
+	return 0;
+}
+
+static int cgps_sink_binary_matrix(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry, const float *values, int rows, int cols)
+{
+	struct cgps_result *res = data;
+	unsigned char buff[4 * CGPS_BINARY_BUFFER];
+	size_t i, n, size;
+
+	size = (size_t)rows * cols;
+	
+	if(cgps_sink_binary_frame(res->out, entry->value, rows, cols) < 0) {
+		logerr("failed write result output");
+		return -1;
+	}
+	for(i = 0, n = 0; i < size; ++i) {
+		cgps_sink_pack_float(buff + 4 * n, values[i]);
+		if(++n == CGPS_BINARY_BUFFER || i + 1 == size) {
+			if(fwrite(buff, 4, n, res->out) != n) {
+				logerr("failed write result output");
+				return -1;
+			}
+			n = 0;
+		}
+	}
+	return 0;
+}
+
+static int cgps_sink_binary_end_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result *res = data;
+	
+	(void)model;
+	
+	if(cgps_sink_binary_frame(res->out, PREDICTED_RESULTS_NONE, 0, 0) < 0) {
+		logerr("failed write result output");
+		return -1;
+	}
+	return cgps_sink_flush(proj, res->out);
+}
+
+/*
+ * JSON output. Each column is written as an array of values.
+ */
+static int cgps_sink_json_begin_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result *res = data;
+	
+	res->nres = 0;
+	if(proj->opts->verbose) {
+		fprintf(res->out, "{\"generator\":\"%s\",\"version\":\"%s\",\"model\":%d,\"result\":[", 
+			proj->opts->prog, PACKAGE_VERSION, model);
+	} else {
+		fprintf(res->out, "{\"model\":%d,\"result\":[", model);
+	}
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_json_begin_result(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	struct cgps_result *res = data;
+	
+	fputs(res->nres++ ? ",\n" : "\n", res->out);
+	if(proj->opts->verbose) {
+		fprintf(res->out, "{\"name\":\"%s\",\"desc\":\"%s\",\"values\":[", entry->name, entry->desc);
+	} else {
+		fprintf(res->out, "{\"name\":\"%s\",\"values\":[", entry->name);
+	}
+	res->nval = 0;
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_json_matrix(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry, const float *values, int rows, int cols)
+{
+	struct cgps_result *res = data;
+	char buff[CGPS_FORMAT_FLOAT_MAX];
+	int i, j;
+	
+	(void)entry;
+
+	for(i = 0; i < cols; ++i) {
+		fputs(res->nval++ ? ",[" : "[", res->out);
+		for(j = 0; j < rows; ++j) {
+			if(j != 0) {
+				fputc(',', res->out);
+			}
+			cgps_format_float(buff, *values++, proj->opts->precision);
+			fputs(buff, res->out);
+		}
+		fputc(']', res->out);
+	}
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_json_end_result(struct cgps_project *proj, void *data, const struct cgps_result_entry *entry)
+{
+	struct cgps_result *res = data;
+	
+	(void)entry;
+	
+	fprintf(res->out, "]}");
+	return cgps_sink_status(proj, res->out);
+}
+
+static int cgps_sink_json_end_document(struct cgps_project *proj, void *data, int model)
+{
+	struct cgps_result *res = data;
+	
+	(void)model;
+	
+	fprintf(res->out, "\n]}\n");
+	return cgps_sink_flush(proj, res->out);
+}
+
+static const struct cgps_result_sink cgps_sink_plain = {
+	NULL, 
+	cgps_sink_plain_begin_result, 
+	cgps_sink_plain_matrix, 
+	cgps_sink_plain_end_result, 
+	cgps_sink_plain_end_document
+};
+
+static const struct cgps_result_sink cgps_sink_xml = {
+	cgps_sink_xml_begin_document, 
+	cgps_sink_xml_begin_result, 
+	cgps_sink_xml_matrix, 
+	cgps_sink_xml_end_result, 
+	cgps_sink_xml_end_document
+};
+
+static const struct cgps_result_sink cgps_sink_binary = {
+	cgps_sink_binary_begin_document, 
+	NULL, 
+	cgps_sink_binary_matrix, 
+	NULL, 
+	cgps_sink_binary_end_document
+};
+
+static const struct cgps_result_sink cgps_sink_json = {
+	cgps_sink_json_begin_document, 
+	cgps_sink_json_begin_result, 
+	cgps_sink_json_matrix, 
+	cgps_sink_json_end_result, 
+	cgps_sink_json_end_document
+};
+
+/*
+ * Get the built-in result sink for output format. The sink data should be 
+ * the cgps_result struct having the output stream. Returns NULL if format 
+ * is unknown.
+ */
+const struct cgps_result_sink * cgps_result_sink_format(int format)
+{
+	switch(format) {
+	case CGPS_OUTPUT_FORMAT_PLAIN:
+		return &cgps_sink_plain;
+	case CGPS_OUTPUT_FORMAT_XML:
+		return &cgps_sink_xml;
+	case CGPS_OUTPUT_FORMAT_BINARY:
+		return &cgps_sink_binary;
+	case CGPS_OUTPUT_FORMAT_JSON:
+		return &cgps_sink_json;
+	}
+	return NULL;
+}
@@ -0,0 +1,459 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Streaming prediction of a table opened by cgps_table_open(). The work is
+ * split in three stages running on their own thread:
+ * 
+ *   load:    parse the next chunk of rows (cgps_table_next())
+ *   predict: predict the chunk and record the result output
+ *   format:  replay the recorded output to the sink (the calling thread)
+ * 
+ * While chunk k is predicted, chunk k + 1 is parsed and the output of chunk 
+ * k - 1 is formatted. The chunks are passed between the stages in a fixed
+ * set of slots. Each stage has an input queue with a single producer and a
+ * single consumer, the slots circulates load -> predict -> format -> load.
+ * No queue can hold more than all slots, so the queues are lock-free rings
+ * where only the consumer moves head and only the producer moves tail.
+ * 
+ * A stage that has nothing to do yields (and eventually sleeps) instead of
+ * blocking, so the stages can run on fewer threads too (i.e. if starting a
+ * thread fails or threads are not supported).
+ */
+
+#define CGPS_STREAM_SLOTS  4     /* chunks in flight */
+#define CGPS_STREAM_SPINS  64    /* idle rounds before sleeping */
+#define CGPS_STREAM_SLEEP  100   /* sleep when idle (microseconds) */
+
+#define CGPS_STREAM_LOAD    0
+#define CGPS_STREAM_PREDICT 1
+#define CGPS_STREAM_FORMAT  2
+#define CGPS_STREAM_STAGES  3
+
+struct cgps_stream_slot
+{
+	struct cgps_table table;            /* chunk of rows (text and names shared with stream table) */
+	struct cgps_result_record record;   /* recorded result output */
+};
+
+struct cgps_stream_queue
+{
+	struct cgps_stream_slot *slot[CGPS_STREAM_SLOTS];
+	unsigned int head;                  /* next slot to pop (consumer) */
+	unsigned int tail;                  /* next slot to push (producer, atomic) */
+};
+
+struct cgps_stream
+{
+	struct cgps_project *proj;          /* the project */
+	struct cgps_table *table;           /* table being read */
+	int index;                          /* model index */
+	int batch;                          /* quantitative data passed direct from chunks */
+	struct cgps_predict pred;           /* prediction (predict stage) */
+	struct cgps_result res;             /* result object (predict stage) */
+	const struct cgps_result_sink *sink;  /* result consumer (format stage) */
+	void *data;                         /* callback data for sink */
+	struct cgps_stream_slot slot[CGPS_STREAM_SLOTS];
+	struct cgps_stream_queue queue[CGPS_STREAM_STAGES];  /* input of each stage */
+	int done[CGPS_STREAM_STAGES];       /* stage has finished */
+	int failed;                         /* a stage has failed (atomic) */
+	int rows;                           /* number of formatted rows */
+};
+
+#ifdef HAVE_LIBPTHREAD
+struct cgps_stream_thread
+{
+	struct cgps_stream *stream;         /* the stream */
+	int stage;                          /* stage run by thread */
+	pthread_t tid;                      /* thread ID */
+};
+#endif
+
+/*
+ * Append slot to queue (producer side).
+ */
+static void cgps_stream_push(struct cgps_stream_queue *queue, struct cgps_stream_slot *slot)
+{
+	unsigned int tail = __sync_fetch_and_add(&queue->tail, 0);
+	
+	queue->slot[tail % CGPS_STREAM_SLOTS] = slot;
+	__sync_fetch_and_add(&queue->tail, 1);
+}
+
+/*
+ * Remove first slot in queue (consumer side). Returns NULL if empty.
+ */
+static struct cgps_stream_slot * cgps_stream_pop(struct cgps_stream_queue *queue)
+{
+	struct cgps_stream_slot *slot;
+	
+	if(__sync_fetch_and_add(&queue->tail, 0) == queue->head) {
+		return NULL;
+	}
+	slot = queue->slot[queue->head % CGPS_STREAM_SLOTS];
+	++queue->head;
+	return slot;
+}
+
+/*
+ * Parse the next chunk into a free slot. The parsed rows are swapped with the
+ * buffers of the slot, so the table parses the following chunk into memory
+ * not used by the other stages. An empty chunk marks the end of table.
+ */
+static int cgps_stream_load(struct cgps_stream *stream)
+{
+	struct cgps_project *proj = stream->proj;
+	struct cgps_table *table = stream->table;
+	struct cgps_stream_slot *slot;
+	float *values;
+	size_t *rowpos;
+	int rows;
+	
+	if(!(slot = cgps_stream_pop(&stream->queue[CGPS_STREAM_LOAD]))) {
+		return 0;
+	}
+	if((rows = cgps_table_next(proj, table)) < 0) {
+		logerr("failed read next chunk of table");
+		return -1;
+	}
+	
+	values = slot->table.values;
+	rowpos = slot->table.rowpos;
+	slot->table.values = table->values;
+	slot->table.rowpos = table->rowpos;
+	slot->table.rows = rows;
+	table->values = values;
+	table->rowpos = rowpos;
+	
+	cgps_stream_push(&stream->queue[CGPS_STREAM_PREDICT], slot);
+	if(rows == 0) {
+		stream->done[CGPS_STREAM_LOAD] = 1;
+	}
+	return 1;
+}
+
+/*
+ * Predict the chunk in next loaded slot and record the result output. The
+ * quantitative data is read direct from the chunk. Models with lagged or 
+ * qualitative data can't be predicted from batch input, all their data is 
+ * loaded by the indata callback instead (called with the chunk table).
+ */
+static int cgps_stream_predict(struct cgps_stream *stream)
+{
+	struct cgps_project *proj = stream->proj;
+	struct cgps_stream_slot *slot;
+	struct cgps_table *chunk;
+	int model;
+	
+	if(!(slot = cgps_stream_pop(&stream->queue[CGPS_STREAM_PREDICT]))) {
+		return 0;
+	}
+	chunk = &slot->table;
+	
+	if(chunk->rows == 0) {
+		cgps_stream_push(&stream->queue[CGPS_STREAM_FORMAT], slot);
+		stream->done[CGPS_STREAM_PREDICT] = 1;
+		return 1;
+	}
+	
+	stream->pred.data = chunk;
+	if(stream->batch) {
+		if(cgps_predict_set_input(proj, &stream->pred, chunk->values, chunk->rows, chunk->cols, chunk->cols, chunk->colnames) < 0) {
+			return -1;
+		}
+	}
+	if((model = cgps_predict(proj, stream->index, &stream->pred)) < 0) {
+		logerr("failed predict model index %d", stream->index);
+		return -1;
+	}
+	if(cgps_result_to_sink(proj, model, &stream->pred, &stream->res, &cgps_result_record_sink, &slot->record) < 0) {
+		logerr("failed get result for model %d", model);
+		return -1;
+	}
+	
+	cgps_stream_push(&stream->queue[CGPS_STREAM_FORMAT], slot);
+	return 1;
+}
+
+/*
+ * Pass the recorded output of the next predicted slot to the sink and return
+ * the slot to the load stage.
+ */
+static int cgps_stream_format(struct cgps_stream *stream)
+{
+	struct cgps_project *proj = stream->proj;
+	struct cgps_stream_slot *slot;
+	int status;
+	
+	if(!(slot = cgps_stream_pop(&stream->queue[CGPS_STREAM_FORMAT]))) {
+		return 0;
+	}
+	if(slot->table.rows == 0) {
+		stream->done[CGPS_STREAM_FORMAT] = 1;
+		return 1;
+	}
+	
+	status = cgps_result_replay(proj, &slot->record, stream->sink, stream->data);
+	cgps_result_record_reset(&slot->record);
+	stream->rows += slot->table.rows;
+	
+	cgps_stream_push(&stream->queue[CGPS_STREAM_LOAD], slot);
+	return status < 0 ? -1 : 1;
+}
+
+static int (* const cgps_stream_step[CGPS_STREAM_STAGES])(struct cgps_stream *) = {
+	cgps_stream_load, 
+	cgps_stream_predict, 
+	cgps_stream_format
+};
+
+/*
+ * Run the stages in the stages bitmask until they are done or any stage has
+ * failed. Returns -1 on failure.
+ */
+static int cgps_stream_run(struct cgps_stream *stream, int stages)
+{
+	int i, status, active, worked, idle = 0;
+	
+	for(;;) {
+		if(__sync_fetch_and_add(&stream->failed, 0)) {
+			return -1;
+		}
+		for(i = 0, active = 0, worked = 0; i < CGPS_STREAM_STAGES; ++i) {
+			if((stages & (1 << i)) && !stream->done[i]) {
+				if((status = cgps_stream_step[i](stream)) < 0) {
+					__sync_fetch_and_add(&stream->failed, 1);
+					return -1;
+				}
+				active = 1;
+				worked |= status;
+			}
+		}
+		if(!active) {
+			return 0;
+		}
+		if(worked) {
+			idle = 0;
+		} else if(++idle > CGPS_STREAM_SPINS) {
+#ifdef HAVE_UNISTD_H
+			usleep(CGPS_STREAM_SLEEP);
+#endif
+		} else {
+#ifdef HAVE_SCHED_YIELD
+			sched_yield();
+#endif
+		}
+	}
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void * cgps_stream_main(void *arg)
+{
+	struct cgps_stream_thread *thread = (struct cgps_stream_thread *)arg;
+	
+	cgps_stream_run(thread->stream, 1 << thread->stage);
+	return NULL;
+}
+#endif
+
+/*
+ * Setup the slots with buffers for one chunk each. Returns -1 on error.
+ */
+static int cgps_stream_init(struct cgps_stream *stream)
+{
+	struct cgps_project *proj = stream->proj;
+	struct cgps_table *table = stream->table;
+	struct cgps_stream_slot *slot;
+	int i;
+	
+	for(i = 0; i < CGPS_STREAM_SLOTS; ++i) {
+		slot = &stream->slot[i];
+		slot->table.delim = table->delim;
+		slot->table.cols = table->cols;
+		slot->table.colnames = table->colnames;
+		slot->table.text = table->text;
+		slot->table.size = table->size;
+		if(!(slot->table.values = malloc((size_t)table->chunk * table->cols * sizeof(float))) || 
+		   !(slot->table.rowpos = malloc(table->chunk * sizeof(size_t)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		cgps_stream_push(&stream->queue[CGPS_STREAM_LOAD], slot);
+	}
+	return 0;
+}
+
+/*
+ * Release the slot buffers (the shared table data is owned by the table).
+ */
+static void cgps_stream_free(struct cgps_stream *stream)
+{
+	struct cgps_stream_slot *slot;
+	int i;
+	
+	for(i = 0; i < CGPS_STREAM_SLOTS; ++i) {
+		slot = &stream->slot[i];
+		if(slot->table.values) {
+			free(slot->table.values);
+		}
+		if(slot->table.rowpos) {
+			free(slot->table.rowpos);
+		}
+		cgps_result_record_free(&slot->record);
+	}
+}
+
+/*
+ * Predict all rows of table (opened by cgps_table_open()) against model at
+ * index, one chunk at time, and pass the result of each chunk to sink. The 
+ * loading, prediction and output runs overlapped in a pipeline. The sink is
+ * called from the calling thread only. Returns the number of predicted rows
+ * or -1 on error.
+ */
+int cgps_predict_stream_to_sink(struct cgps_project *proj, int index, struct cgps_table *table, const struct cgps_result_sink *sink, void *data)
+{
+	struct cgps_stream *stream;
+	struct cgps_model *model;
+#ifdef HAVE_LIBPTHREAD
+	struct cgps_stream_thread thread[CGPS_STREAM_FORMAT];
+	int started = 0;
+#endif
+	int i, stages = 1 << CGPS_STREAM_FORMAT, status;
+	
+	if(!table->chunk) {
+		logerr("table is not opened for reading in chunks");
+		return -1;
+	}
+	if(!(model = cgps_project_model_index(proj, index))) {
+		return -1;
+	}
+	if(!(stream = calloc(1, sizeof(struct cgps_stream)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	stream->proj  = proj;
+	stream->table = table;
+	stream->index = index;
+	stream->sink  = sink;
+	stream->data  = data;
+	stream->batch = SQX_GetNumStringsInVector(&model->lagparents) == 0 &&
+			SQX_GetNumStringsInVector(&model->qualnames) == 0 &&
+			SQX_GetNumStringsInVector(&model->qlagnames) == 0;
+	
+	if(cgps_stream_init(stream) < 0) {
+		cgps_stream_free(stream);
+		free(stream);
+		return -1;
+	}
+	cgps_predict_init(proj, &stream->pred, NULL);
+	if(cgps_result_init(proj, &stream->res) < 0) {
+		cgps_stream_free(stream);
+		free(stream);
+		return -1;
+	}
+	
+	/*
+	 * The stages not started on a thread are run by the calling thread.
+	 */
+	for(i = 0; i < CGPS_STREAM_FORMAT; ++i) {
+#ifdef HAVE_LIBPTHREAD
+		thread[started].stream = stream;
+		thread[started].stage = i;
+		if(pthread_create(&thread[started].tid, NULL, cgps_stream_main, &thread[started]) == 0) {
+			++started;
+			continue;
+		}
+		logwarn("failed create thread for stream stage %d", i);
+#endif
+		stages |= 1 << i;
+	}
+	
+	status = cgps_stream_run(stream, stages);
+	
+#ifdef HAVE_LIBPTHREAD
+	for(i = 0; i < started; ++i) {
+		pthread_join(thread[i].tid, NULL);
+	}
+#endif
+	if(stream->failed) {
+		status = -1;
+	}
+	if(status == 0) {
+		status = stream->rows;
+		debug("predicted %d rows in stream", status);
+	}
+	
+	cgps_result_cleanup(proj, &stream->res);
+	cgps_predict_cleanup(proj, &stream->pred);
+	cgps_stream_free(stream);
+	free(stream);
+	return status;
+}
+
+/*
+ * Predict all rows of table as cgps_predict_stream_to_sink() and write the 
+ * result to out in the output format.
+ */
+int cgps_predict_stream(struct cgps_project *proj, int index, struct cgps_table *table, FILE *out)
+{
+	const struct cgps_result_sink *sink;
+	struct cgps_result res;
+	
+	if(!(sink = cgps_result_sink_format(proj->opts->format))) {
+		logerr("unknown output format %d", proj->opts->format);
+		return -1;
+	}
+	memset(&res, 0, sizeof(struct cgps_result));
+	res.out = out;
+	
+	return cgps_predict_stream_to_sink(proj, index, table, sink, &res);
+}
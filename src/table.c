@@ -0,0 +1,671 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * Built-in loader for descriptor tables in delimited text (CSV or TSV). The
+ * first line is a header with the column names. The values are parsed once 
+ * when the table is loaded and the text is kept for the qualitative (string)
+ * values. The cgps_table_indata() callback picks the columns by name in the
+ * variable order requested by SIMCA-QP.
+ * 
+ * Large tables can be opened with cgps_table_open() instead. The file is then
+ * mapped and parsed in chunks of rows by cgps_table_next(), so only one chunk
+ * of values is in memory and the pages already read are released.
+ * 
+ * The lines and cells are found using memchr(3), that is vectorized by the
+ * C library on most platforms. Numbers with up to 15 significant digits and 
+ * a decimal exponent within +/- 22 are converted exact with a single double
+ * multiplication or division (same result as strtod), others by strtod(3).
+ */
+
+#define CGPS_TABLE_DIGITS 15         /* significant digits exact in double */
+#define CGPS_TABLE_NUMBER 64         /* max length of number for strtod() */
+
+static const double cgps_table_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Value stored for missing and non-numeric cells.
+ */
+static float cgps_table_nan(void)
+{
+	double zero = 0.0;
+	return (float)(zero / zero);
+}
+
+/*
+ * Strip blanks, carriage return and surrounding quotes from cell.
+ */
+static void cgps_table_trim(const char **start, const char **end)
+{
+	const char *s = *start, *e = *end;
+	
+	while(s < e && (*s == ' ' || *s == '\t')) {
+		++s;
+	}
+	while(e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) {
+		--e;
+	}
+	if(e - s >= 2 && *s == '"' && e[-1] == '"') {
+		++s;
+		--e;
+	}
+	*start = s;
+	*end = e;
+}
+
+/*
+ * Parse number in s (not terminated, ends at e) using strtod().
+ */
+static int cgps_table_strtod(const char *s, const char *e, float *f)
+{
+	char buff[CGPS_TABLE_NUMBER];
+	char *p;
+	double d;
+	
+	if(e - s >= CGPS_TABLE_NUMBER) {
+		return -1;
+	}
+	memcpy(buff, s, e - s);
+	buff[e - s] = '\0';
+	d = strtod(buff, &p);
+	if(p == buff || *p != '\0') {
+		return -1;
+	}
+	*f = (float)d;
+	return 0;
+}
+
+/*
+ * Parse number in s (not terminated, ends at e). Returns -1 if the cell is
+ * empty or not a number.
+ */
+static int cgps_table_parse_float(const char *s, const char *e, float *f)
+{
+	const char *p = s;
+	double mant = 0.0;
+	int digits = 0, scale = 0, exp10 = 0, neg = 0, eneg = 0, any = 0;
+	
+	cgps_table_trim(&s, &e);
+	p = s;
+	
+	if(p < e && (*p == '-' || *p == '+')) {
+		neg = *p++ == '-';
+	}
+	for(; p < e && *p >= '0' && *p <= '9'; ++p, any = 1) {
+		if(digits < CGPS_TABLE_DIGITS) {
+			mant = mant * 10 + (*p - '0');
+			if(mant != 0.0) {
+				++digits;
+			}
+		} else {
+			return cgps_table_strtod(s, e, f);
+		}
+	}
+	if(p < e && *p == '.') {
+		for(++p; p < e && *p >= '0' && *p <= '9'; ++p, any = 1) {
+			if(digits < CGPS_TABLE_DIGITS) {
+				mant = mant * 10 + (*p - '0');
+				if(mant != 0.0) {
+					++digits;
+				}
+				--scale;
+			} else {
+				return cgps_table_strtod(s, e, f);
+			}
+		}
+	}
+	if(!any) {
+		return cgps_table_strtod(s, e, f);   /* nan, inf or not a number */
+	}
+	if(p < e && (*p == 'e' || *p == 'E')) {
+		if(++p < e && (*p == '-' || *p == '+')) {
+			eneg = *p++ == '-';
+		}
+		if(p == e) {
+			return -1;
+		}
+		for(; p < e && *p >= '0' && *p <= '9'; ++p) {
+			if(exp10 < 1000) {
+				exp10 = exp10 * 10 + (*p - '0');
+			}
+		}
+	}
+	if(p != e) {
+		return -1;
+	}
+	
+	exp10 = (eneg ? -exp10 : exp10) + scale;
+	if(exp10 < -22 || exp10 > 22) {
+		return cgps_table_strtod(s, e, f);
+	}
+	if(exp10 < 0) {
+		mant /= cgps_table_pow10[-exp10];
+	} else {
+		mant *= cgps_table_pow10[exp10];
+	}
+	*f = (float)(neg ? -mant : mant);
+	return 0;
+}
+
+/*
+ * Get end of line starting at s (the newline or end of text).
+ */
+static const char * cgps_table_eol(const char *s, const char *end)
+{
+	const char *e = memchr(s, '\n', end - s);
+	return e ? e : end;
+}
+
+/*
+ * Split the header line into column names.
+ */
+static int cgps_table_header(struct cgps_project *proj, struct cgps_table *table, const char *s, const char *e)
+{
+	const char *c, *ce, *n, *ne;
+	char *name;
+	int i;
+	
+	if(!table->delim) {
+		table->delim = memchr(s, '\t', e - s) ? '\t' : ',';
+	}
+	
+	for(table->cols = 1, c = s; (c = memchr(c, table->delim, e - c)); ++c) {
+		++table->cols;
+	}
+	if(!(table->header = malloc(e - s + 1)) || 
+	   !(table->colnames = malloc(table->cols * sizeof(const char *)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	
+	name = table->header;
+	for(i = 0, c = s; i < table->cols; ++i, c = ce + 1) {
+		if(!(ce = memchr(c, table->delim, e - c))) {
+			ce = e;
+		}
+		n = c;
+		ne = ce;
+		cgps_table_trim(&n, &ne);
+		memcpy(name, n, ne - n);
+		table->colnames[i] = name;
+		name += ne - n;
+		*name++ = '\0';
+	}
+	return 0;
+}
+
+/*
+ * Parse the values of up to max rows starting at the next unparsed line. The
+ * rows replace the rows already parsed. Returns -1 on error.
+ */
+static int cgps_table_parse_rows(struct cgps_project *proj, struct cgps_table *table, int max)
+{
+	const char *s, *e, *c, *ce, *end = table->text + table->size;
+	float *values, missing = cgps_table_nan();
+	int i;
+	
+	for(table->rows = 0, s = table->text + table->next; s < end && table->rows < max; s = e + 1) {
+		e = cgps_table_eol(s, end);
+		++table->line;
+		if(e == s || (e - s == 1 && *s == '\r')) {
+			continue;                    /* empty line */
+		}
+		table->rowpos[table->rows] = s - table->text;
+		values = table->values + (size_t)table->rows * table->cols;
+		for(i = 0, c = s; c <= e; ++i, c = ce + 1) {
+			if(!(ce = memchr(c, table->delim, e - c))) {
+				ce = e;
+			}
+			if(i == table->cols) {
+				logerr("line %d has more than %d columns", table->line, table->cols);
+				return -1;
+			}
+			if(cgps_table_parse_float(c, ce, &values[i]) < 0) {
+				values[i] = missing;
+			}
+		}
+		for(; i < table->cols; ++i) {
+			values[i] = missing;
+		}
+		++table->rows;
+	}
+	table->next = s < end ? (size_t)(s - table->text) : table->size;
+	return 0;
+}
+
+/*
+ * Count the lines in text between s and end.
+ */
+static int cgps_table_count_lines(const char *s, const char *end)
+{
+	int lines = 0;
+	
+	while(s < end && (s = memchr(s, '\n', end - s))) {
+		++lines;
+		++s;
+	}
+	return lines + 1;
+}
+
+/*
+ * Parse the header (the first non-empty line) of the table text. 
+ */
+static int cgps_table_start(struct cgps_project *proj, struct cgps_table *table, const char *path)
+{
+	const char *s = table->text, *e, *end = table->text + table->size;
+	
+	for(e = cgps_table_eol(s, end), table->line = 1; s < end && (e == s || (e - s == 1 && *s == '\r')); e = cgps_table_eol(s, end)) {
+		s = e + 1;
+		++table->line;
+	}
+	if(s >= end) {
+		logerr("table %s has no header", path);
+		return -1;
+	}
+	if(cgps_table_header(proj, table, s, e) < 0) {
+		return -1;
+	}
+	table->next = e < end ? (size_t)(e + 1 - table->text) : table->size;
+	return 0;
+}
+
+/*
+ * Load the table in path. The delimiter is detected from the header if delim
+ * is 0. Returns -1 on error.
+ */
+int cgps_table_load(struct cgps_project *proj, struct cgps_table *table, const char *path, int delim)
+{
+	FILE *fp;
+	long size;
+	int lines;
+	
+	memset(table, 0, sizeof(struct cgps_table));
+	table->delim = delim;
+	
+	if(!(fp = fopen(path, "rb"))) {
+		logerr("failed open %s", path);
+		return -1;
+	}
+	if(fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		logerr("failed get size of %s", path);
+		fclose(fp);
+		return -1;
+	}
+	if(!(table->text = malloc(size + 1))) {
+		logerr("failed alloc memory");
+		fclose(fp);
+		return -1;
+	}
+	if(fread(table->text, 1, size, fp) != (size_t)size) {
+		logerr("failed read %s", path);
+		fclose(fp);
+		cgps_table_free(table);
+		return -1;
+	}
+	fclose(fp);
+	table->text[size] = '\0';
+	table->size = size;
+	
+	if(cgps_table_start(proj, table, path) < 0) {
+		cgps_table_free(table);
+		return -1;
+	}
+	
+	lines = cgps_table_count_lines(table->text + table->next, table->text + table->size);
+	if(!(table->values = malloc((size_t)lines * table->cols * sizeof(float) + 1)) || 
+	   !(table->rowpos = malloc(lines * sizeof(size_t)))) {
+		logerr("failed alloc memory");
+		cgps_table_free(table);
+		return -1;
+	}
+	if(cgps_table_parse_rows(proj, table, lines) < 0) {
+		logerr("failed parse %s", path);
+		cgps_table_free(table);
+		return -1;
+	}
+	
+	debug("loaded table %s (%d rows, %d columns)", path, table->rows, table->cols);
+	return 0;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+
+/*
+ * Open the table in path for reading in chunks of chunk rows. The file is 
+ * mapped read-only and the rows are parsed by cgps_table_next(). Returns -1
+ * on error.
+ */
+int cgps_table_open(struct cgps_project *proj, struct cgps_table *table, const char *path, int delim, int chunk, int flags)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+	
+	memset(table, 0, sizeof(struct cgps_table));
+	table->delim = delim;
+	
+	if(chunk <= 0) {
+		logerr("invalid chunk size %d", chunk);
+		return -1;
+	}
+	if((fd = open(path, O_RDONLY)) < 0) {
+		logerr("failed open %s", path);
+		return -1;
+	}
+	if(fstat(fd, &st) < 0 || st.st_size == 0) {
+		logerr("failed get size of %s (or empty file)", path);
+		close(fd);
+		return -1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED) {
+		logerr("failed map %s", path);
+		return -1;
+	}
+	
+	table->text = addr;
+	table->size = st.st_size;
+	table->chunk = chunk;
+	
+	/*
+	 * The file is read once from start to end. Huge pages is only a hint,
+	 * not all file systems supports them for file mappings.
+	 */
+	if(madvise(addr, table->size, MADV_SEQUENTIAL) < 0) {
+		debug("failed set sequential access for %s", path);
+	}
+#ifdef MADV_HUGEPAGE
+	if(flags & CGPS_TABLE_HUGEPAGES) {
+		if(madvise(addr, table->size, MADV_HUGEPAGE) < 0) {
+			debug("huge pages not used for %s", path);
+		}
+	}
+#endif
+	
+	if(cgps_table_start(proj, table, path) < 0) {
+		cgps_table_free(table);
+		return -1;
+	}
+	if(!(table->values = malloc((size_t)chunk * table->cols * sizeof(float))) || 
+	   !(table->rowpos = malloc(chunk * sizeof(size_t)))) {
+		logerr("failed alloc memory");
+		cgps_table_free(table);
+		return -1;
+	}
+	
+	debug("opened table %s (%lu bytes, %d columns, %d rows per chunk)", path, 
+	      (unsigned long)table->size, table->cols, chunk);
+	return 0;
+}
+
+/*
+ * Parse the next chunk of rows from table opened by cgps_table_open(). The 
+ * pages of the previous chunks are released. Returns number of rows, 0 at 
+ * end of table or -1 on error.
+ */
+int cgps_table_next(struct cgps_project *proj, struct cgps_table *table)
+{
+	size_t page = sysconf(_SC_PAGESIZE), done;
+	
+	if(!table->chunk) {
+		logerr("table is not opened for reading in chunks");
+		return -1;
+	}
+	
+	done = table->next - table->next % page;
+	if(done > table->drop) {
+		madvise(table->text + table->drop, done - table->drop, MADV_DONTNEED);
+		table->drop = done;
+	}
+	
+	if(cgps_table_parse_rows(proj, table, table->chunk) < 0) {
+		return -1;
+	}
+	return table->rows;
+}
+
+#else /* ! HAVE_SYS_MMAN_H */
+
+int cgps_table_open(struct cgps_project *proj, struct cgps_table *table, const char *path, int delim, int chunk, int flags)
+{
+	memset(table, 0, sizeof(struct cgps_table));
+	logerr("memory mapped tables are not supported on this platform");
+	return -1;
+}
+
+int cgps_table_next(struct cgps_project *proj, struct cgps_table *table)
+{
+	logerr("table is not opened for reading in chunks");
+	return -1;
+}
+
+#endif /* HAVE_SYS_MMAN_H */
+
+/*
+ * Release memory used by table.
+ */
+void cgps_table_free(struct cgps_table *table)
+{
+	if(table->text) {
+#ifdef HAVE_SYS_MMAN_H
+		if(table->chunk) {
+			munmap(table->text, table->size);
+		} else {
+			free(table->text);
+		}
+#else
+		free(table->text);
+#endif
+	}
+	if(table->header) {
+		free(table->header);
+	}
+	if(table->colnames) {
+		free(table->colnames);
+	}
+	if(table->values) {
+		free(table->values);
+	}
+	if(table->rowpos) {
+		free(table->rowpos);
+	}
+	memset(table, 0, sizeof(struct cgps_table));
+}
+
+/*
+ * Get column index of each name in names. Returns -1 if any is missing.
+ */
+static int cgps_table_columns(struct cgps_project *proj, struct cgps_table *table, SQX_StringVector *names, int *column, int num)
+{
+	const char *str;
+	int i, j;
+	
+	for(j = 0; j < num; ++j) {
+		if(!SQX_GetStringFromVector(names, j + 1, &str)) {
+			logerr("failed get string from vector (%s)", cgps_simcaq_error());
+			return -1;
+		}
+		for(i = 0; i < table->cols; ++i) {
+			if(str && strcmp(table->colnames[i], str) == 0) {
+				break;
+			}
+		}
+		if(i == table->cols) {
+			logerr("variable %s is missing in table", str ? str : "(null)");
+			return -1;
+		}
+		column[j] = i;
+	}
+	return 0;
+}
+
+/*
+ * Fill fmx with the values of the columns in names.
+ */
+static int cgps_table_floats(struct cgps_project *proj, struct cgps_table *table, SQX_FloatMatrix *fmx, const int *column, int num)
+{
+	const float *values;
+	int i, j;
+	
+	if(!SQX_InitFloatMatrix(fmx, table->rows, num)) {
+		logerr("failed initilize float matrix (%s)", cgps_simcaq_error());
+		return -1;
+	}
+	for(i = 0; i < table->rows; ++i) {
+		values = table->values + (size_t)i * table->cols;
+		for(j = 0; j < num; ++j) {
+			if(!SQX_SetDataInFloatMatrix(fmx, i + 1, j + 1, values[column[j]])) {
+				logerr("failed set float value in matrix (%s)", cgps_simcaq_error());
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Fill smx with the text of the columns in names.
+ */
+static int cgps_table_strings(struct cgps_project *proj, struct cgps_table *table, SQX_StringMatrix *smx, const int *column, int num)
+{
+	const char *s, *e, *c, *ce, *end = table->text + table->size;
+	char *buff = NULL;
+	size_t size = 0;
+	int i, j, k, status = 0;
+	
+	if(!SQX_InitStringMatrix(smx, table->rows, num)) {
+		logerr("failed initilize string matrix (%s)", cgps_simcaq_error());
+		return -1;
+	}
+	for(i = 0; i < table->rows && status == 0; ++i) {
+		s = table->text + table->rowpos[i];
+		e = cgps_table_eol(s, end);
+		for(j = 0; j < num; ++j) {
+			for(k = 0, c = s; k < column[j] && c && c < e; ++k) {
+				if((c = memchr(c, table->delim, e - c))) {
+					++c;
+				}
+			}
+			if(!c || c > e) {
+				c = ce = e;      /* short line */
+			} else if(!(ce = memchr(c, table->delim, e - c))) {
+				ce = e;
+			}
+			cgps_table_trim(&c, &ce);
+			if((size_t)(ce - c) >= size) {
+				size = ce - c + 32;
+				free(buff);
+				if(!(buff = malloc(size))) {
+					logerr("failed alloc memory");
+					return -1;
+				}
+			}
+			memcpy(buff, c, ce - c);
+			buff[ce - c] = '\0';
+			if(!SQX_SetStringInMatrix(smx, i + 1, j + 1, buff)) {
+				logerr("failed set string in matrix (%s)", cgps_simcaq_error());
+				status = -1;
+				break;
+			}
+		}
+	}
+	free(buff);
+	return status;
+}
+
+/*
+ * The datfunc callback for loading prediction data from the table passed as
+ * data to cgps_predict_init(). The columns are picked by the names in the 
+ * order requested. Quantitative and lagged data are taken from the parsed
+ * values and qualitative data from the text.
+ */
+int cgps_table_indata(struct cgps_project *proj, void *data, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type)
+{
+	struct cgps_table *table = (struct cgps_table *)data;
+	int num, status, *column;
+	
+	if(!table) {
+		logerr("no table for prediction data");
+		return -1;
+	}
+	num = SQX_GetNumStringsInVector(names);
+	if(!(column = malloc((num > 0 ? num : 1) * sizeof(int)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	if(cgps_table_columns(proj, table, names, column, num) < 0) {
+		free(column);
+		return -1;
+	}
+	
+	switch(type) {
+	case CGPS_GET_QUANTITATIVE_DATA:
+	case CGPS_GET_LAG_PARENTS_DATA:
+		status = cgps_table_floats(proj, table, fmx, column, num);
+		break;
+	case CGPS_GET_QUALITATIVE_DATA:
+	case CGPS_GET_QUAL_LAGGED_DATA:
+		status = cgps_table_strings(proj, table, smx, column, num);
+		break;
+	default:
+		logerr("unknown data type %d", type);
+		status = -1;
+		break;
+	}
+	
+	free(column);
+	return status;
+}
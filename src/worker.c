@@ -0,0 +1,200 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ * 
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+
+#include "chemgps.h"
+#include "simcaqp.h"
+
+/*
+ * A minimal worker pool for running independent jobs in parallel. The jobs
+ * are handed out from a shared counter, so a slow job don't stall the others.
+ */
+
+struct cgps_worker
+{
+	struct cgps_project *proj;  /* the project */
+	cgps_worker_func func;      /* job function */
+	void *arg;                  /* job function argument */
+	int jobs;                   /* number of jobs */
+	int next;                   /* next job to run (atomic) */
+	int failed;                 /* number of failed jobs (atomic) */
+#ifdef HAVE_LIBPTHREAD
+	pthread_t *tids;            /* started threads */
+#endif
+	int started;                /* number of started threads */
+};
+
+/*
+ * Run the next job if any is left. Returns 0 when all jobs have been taken.
+ */
+int cgps_worker_help(struct cgps_worker *worker)
+{
+	int job;
+	
+	if((job = __sync_fetch_and_add(&worker->next, 1)) >= worker->jobs) {
+		return 0;
+	}
+	if(worker->func(worker->proj, worker->arg, job) < 0) {
+		__sync_fetch_and_add(&worker->failed, 1);
+	}
+	return 1;
+}
+
+/*
+ * Run jobs until there are no more left.
+ */
+static void * cgps_worker_main(void *arg)
+{
+	struct cgps_worker *worker = (struct cgps_worker *)arg;
+	
+	while(cgps_worker_help(worker)) {
+		;
+	}
+	return NULL;
+}
+
+/*
+ * Get number of worker threads to use as defined by the wthreads option. This
+ * is separate from the threading option, that sets the number of threads used
+ * internal by SIMCA-QP.
+ */
+int cgps_worker_threads(struct cgps_project *proj)
+{
+	int threads = 1;
+	
+	if(proj->opts->wthreads > 0) {
+		threads = proj->opts->wthreads;
+	} else if(proj->opts->wthreads == CGPS_THREADING_AUTO) {
+		threads = cgps_detect_cpus(proj);
+	}
+	return threads > 0 ? threads : 1;
+}
+
+/*
+ * Start up to threads number of threads running jobs number of calls to func
+ * in the background. The jobs not picked up by any thread (i.e. if threads is
+ * 0 or starting a thread failed) are run by cgps_worker_help() or by the 
+ * calling thread in cgps_worker_join(). Returns NULL on error.
+ */
+struct cgps_worker * cgps_worker_start(struct cgps_project *proj, int threads, int jobs, cgps_worker_func func, void *arg)
+{
+	struct cgps_worker *worker;
+#ifdef HAVE_LIBPTHREAD
+	int i;
+#endif
+	
+	if(!(worker = malloc(sizeof(struct cgps_worker)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	worker->proj    = proj;
+	worker->func    = func;
+	worker->arg     = arg;
+	worker->jobs    = jobs;
+	worker->next    = 0;
+	worker->failed  = 0;
+	worker->started = 0;
+	
+	if(threads > jobs) {
+		threads = jobs;
+	}
+	
+#ifdef HAVE_LIBPTHREAD
+	worker->tids = NULL;
+	if(threads > 0) {
+		if(!(worker->tids = malloc(threads * sizeof(pthread_t)))) {
+			logerr("failed alloc memory");
+			free(worker);
+			return NULL;
+		}
+		for(i = 0; i < threads; ++i) {
+			if(pthread_create(&worker->tids[i], NULL, cgps_worker_main, worker) != 0) {
+				logerr("failed create worker thread (using %d threads)", worker->started);
+				break;
+			}
+			++worker->started;
+		}
+		debug("started %d worker threads for %d jobs", worker->started, jobs);
+	}
+#endif
+	
+	return worker;
+}
+
+/*
+ * Run the remaining jobs in the calling thread and wait for the started 
+ * threads to finish. The worker is released. Returns the number of failed
+ * jobs.
+ */
+int cgps_worker_join(struct cgps_worker *worker)
+{
+	int failed;
+#ifdef HAVE_LIBPTHREAD
+	int i;
+#endif
+	
+	cgps_worker_main(worker);
+	
+#ifdef HAVE_LIBPTHREAD
+	for(i = 0; i < worker->started; ++i) {
+		pthread_join(worker->tids[i], NULL);
+	}
+	if(worker->tids) {
+		free(worker->tids);
+	}
+#endif
+	
+	failed = worker->failed;
+	free(worker);
+	return failed;
+}
+
+/*
+ * Run jobs number of calls to func using up to threads number of threads. The 
+ * calling thread participates in running the jobs. Returns the number of
+ * failed jobs or -1 on error.
+ */
+int cgps_worker_run(struct cgps_project *proj, int threads, int jobs, cgps_worker_func func, void *arg)
+{
+	struct cgps_worker *worker;
+	
+	if(!(worker = cgps_worker_start(proj, threads - 1, jobs, func, arg))) {
+		return -1;
+	}
+	return cgps_worker_join(worker);
+}